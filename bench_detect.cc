@@ -0,0 +1,133 @@
+#include "termdetect.hh"
+#include "termsim.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <getopt.h>
+
+
+// Measure the time info::alloc needs for each simulated emulator at various round trip times.
+
+namespace {
+
+  // Transport for the pseudo terminal of the simulator.  A pseudo terminal has no line speed, the speed
+  // and TERM come from the profile.  The round trips and timeouts are counted; fd_transport counts the
+  // system calls it makes.
+  struct bench_transport final : terminal::fd_transport {
+    bench_transport(int fd_, const terminal::sim::profile& prof) : fd_transport(fd_), term(prof.term), baud(prof.baud) { }
+
+    bool write(std::string_view request) override { ++round_trips; return fd_transport::write(request); }
+    int wait(int timeout) override
+    {
+      auto n = fd_transport::wait(timeout);
+      if (n == 0)
+        ++timeouts;
+      return n;
+    }
+    unsigned speed() override { return baud; }
+    const char* getenv(const char* name) override { return strcmp(name, "TERM") == 0 ? term.c_str() : fd_transport::getenv(name); }
+
+    unsigned round_trips = 0;
+    unsigned timeouts = 0;
+
+  private:
+    std::string term;
+    unsigned baud;
+  };
+
+
+  std::vector<double> parse_list(std::string_view sv)
+  {
+    std::vector<double> res;
+    while (! sv.empty()) {
+      auto comma = sv.find(',');
+      res.push_back(std::stod(std::string(sv.substr(0, comma))));
+      sv.remove_prefix(comma == std::string_view::npos ? sv.size() : comma + 1);
+    }
+    return res;
+  }
+
+} // anonymous namespace
+
+
+int main(int argc, char* argv[])
+{
+  unsigned iterations = 1000;
+  std::vector<double> rtts { 0.1, 5.0, 50.0, 200.0 };
+  std::string only;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:p:d:")) != -1)
+    switch (opt) {
+    case 'n':
+      iterations = std::max(1, atoi(optarg));
+      break;
+    case 'r':
+      rtts = parse_list(optarg);
+      break;
+    case 'p':
+      only = optarg;
+      break;
+    case 'd':
+      terminal::info::set_request_delay(atoi(optarg));
+      break;
+    default:
+      std::cerr << "Usage: " << argv[0] << " [-n ITERATIONS] [-r RTT,...] [-p PROFILE] [-d REQUEST-DELAY] [PROFILE-DIR]\n";
+      return EXIT_FAILURE;
+    }
+  std::filesystem::path dir = optind < argc ? argv[optind] : PROFILE_DIR;
+
+  std::vector<std::filesystem::path> files;
+  for (const auto& e : std::filesystem::directory_iterator(dir))
+    if (e.path().extension() == ".profile" && (only.empty() || e.path().stem() == only))
+      files.emplace_back(e.path());
+  std::ranges::sort(files);
+
+  std::cout << std::format("{:<12} {:>8} {:>9} {:>9} {:>9} {:>6} {:>8} {:>8}\n", "profile", "rtt(ms)", "p50(ms)", "p99(ms)", "max(ms)", "trips", "timeouts", "syscalls");
+
+  for (const auto& f : files) {
+    auto prof = terminal::sim::profile::load(f.c_str());
+    if (! prof) {
+      std::cerr << "cannot load " << f << std::endl;
+      continue;
+    }
+
+    for (auto rtt : rtts) {
+      prof->latency = rtt;
+
+      std::vector<double> times;
+      unsigned long round_trips = 0;
+      unsigned long timeouts = 0;
+      unsigned long syscalls = 0;
+      for (unsigned i = 0; i < iterations; ++i) {
+        // A new simulator each time, late replies from the previous run must not interfere.
+        terminal::sim::simulator sim(*prof);
+        bench_transport tr(sim.slave(), *prof);
+
+        auto start = tr.now();
+        auto ti = terminal::info::alloc(tr);
+        auto end = tr.now();
+
+        times.push_back(std::chrono::duration<double,std::milli>(end - start).count());
+        round_trips += tr.round_trips;
+        timeouts += tr.timeouts;
+        syscalls += tr.syscalls;
+      }
+
+      std::ranges::sort(times);
+      auto p50 = times[times.size() / 2];
+      auto p99 = times[std::min(times.size() - 1, times.size() * 99 / 100)];
+      std::cout << std::format("{:<12} {:>8.1f} {:>9.2f} {:>9.2f} {:>9.2f} {:>6.1f} {:>8.1f} {:>8.1f}\n", prof->name, rtt, p50, p99, times.back(),
+                               double(round_trips) / iterations, double(timeouts) / iterations, double(syscalls) / iterations);
+    }
+  }
+}
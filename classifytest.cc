@@ -0,0 +1,130 @@
+#include "termdetect.hh"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+
+namespace {
+
+  // Recorded fingerprints of supported emulators and the expected results.
+  const struct {
+    const char* raw;
+    terminal::implementations implementation;
+    const char* version;
+    const char* emulation;
+  } fingerprints[] {
+    { "TN=<NO REPLY>, DA1=65;1;9, DA2=65;7600;1, DA3=7E565445, OSC702=<NOT ISSUED>, Q=<NOT ISSUED>", terminal::implementations::vte, "0.76", "VT525" },
+    { "TN=666F6F74, DA1=62;4;22;28, DA2=1;011302;0, DA3=464f4f54, OSC702=<NOT ISSUED>, Q=foot(1.13.2)", terminal::implementations::foot, "1.13.2", "VT101" },
+    { "TN=<NOT ISSUED>, DA1=6, DA2=0;1301;1, DA3=<NOT ISSUED>, OSC702=<NOT ISSUED>, Q=<NOT ISSUED>", terminal::implementations::alacritty, "13.1.1", "VT102" },
+    { "TN=<NOT ISSUED>, DA1=6, DA2=<NO REPLY>, DA3=<NOT ISSUED>, OSC702=<NOT ISSUED>, Q=<NOT ISSUED>", terminal::implementations::st, "0", "VT102" },
+    { "TN=<NOT ISSUED>, DA1=64;1;2;6;9;15;16;17;18;21;22;28, DA2=41;390;0, DA3=00000000, OSC702=<NOT ISSUED>, Q=XTerm(390)", terminal::implementations::xterm, "390", "VT420" },
+    { "TN=787465726d2d6b69747479, DA1=62;, DA2=1;4000;29, DA3=<NOT ISSUED>, OSC702=<NOT ISSUED>, Q=kitty(0.31.0)", terminal::implementations::kitty, "0.31.0", "VT220" },
+    { "TN=<NOT ISSUED>, DA1=1;2, DA2=85;95;0, DA3=<NOT ISSUED>, OSC702=rxvt-unicode(9.31), Q=<NOT ISSUED>", terminal::implementations::rxvt, "9.5", "VT100 w/ Advanced Video Option" },
+    { "TN=<NOT ISSUED>, DA1=<NO REPLY>, DA2=<NO REPLY>, DA3=<NOT ISSUED>, OSC702=<NOT ISSUED>, Q=<NOT ISSUED>, TERM=eterm-color", terminal::implementations::emacsterm, "0", "VT100" },
+    { "TN=<NOT ISSUED>, DA1=6, DA2=<NO REPLY>, DA3=<NOT ISSUED>, OSC702=<NOT ISSUED>, Q=<NOT ISSUED>, TERM=linux", terminal::implementations::linuxconsole, "0", "VT102" },
+    { "TN=787465726d2d6b69747479, DA1=62;, DA2=1;4000;29, DA3=<NOT ISSUED>, OSC702=<NOT ISSUED>, Q=kitty(0.31.0), MODES=?2048;0,?2026;2, KEYBOARD=0", terminal::implementations::kitty, "0.31.0", "VT220" },
+    { "TN=<NOT ISSUED>, DA1=64;1;2;6;9;15;16;17;18;21;22;28, DA2=41;390;0, DA3=00000000, OSC702=<NOT ISSUED>, Q=XTerm(390), MODES=<NO REPLY>, KEYBOARD=<NO REPLY>, TCAP=, SGR=0;48:2:1:2:3m", terminal::implementations::xterm, "390", "VT420" },
+    { "TN=<NOT ISSUED>, DA1=65;1;4;6;9;15;22;28;29;314, DA2=65;403;0, DA3=C0000000, OSC702=<NOT ISSUED>, Q=contour 0.4.3, MODES=?2048;2,?2026;2", terminal::implementations::contour, "0.4.3", "VT525" },
+  };
+
+
+
+  // The fingerprint containing the text.
+  std::string_view fingerprint(std::string_view text)
+  {
+    for (const auto& fp : fingerprints)
+      if (std::string_view(fp.raw).contains(text))
+        return fp.raw;
+    return { };
+  }
+
+} // anonymous namespace
+
+
+int main()
+{
+  int result = EXIT_SUCCESS;
+
+  for (const auto& fp : fingerprints) {
+    auto r = terminal::replies::parse(fp.raw);
+    if (! r) {
+      std::cout << "cannot parse: " << fp.raw << std::endl;
+      result = EXIT_FAILURE;
+      continue;
+    }
+
+    auto ti = terminal::info::classify(*r);
+    if (ti->implementation != fp.implementation || ti->implementation_version != fp.version || ti->emulation_name() != fp.emulation) {
+      std::cout << "misclassified: " << fp.raw << std::endl
+                << "  got " << ti->implementation_name() << ' ' << ti->implementation_version << ' ' << ti->emulation_name() << std::endl;
+      result = EXIT_FAILURE;
+    }
+
+    // The classification must reproduce the raw string, minus the TERM value.
+    std::string expected_raw = fp.raw;
+    if (auto pos = expected_raw.find(", TERM="); pos != std::string::npos)
+      expected_raw.erase(pos);
+    if (ti->raw != expected_raw) {
+      std::cout << "raw mismatch: " << fp.raw << std::endl
+                << "  got " << ti->raw << std::endl;
+      result = EXIT_FAILURE;
+    }
+
+    // A detection with these replies must come to the same result.
+    auto plan = terminal::info::explain(*r);
+    if (plan.find("result: " + ti->implementation_name() + ' ') == std::string::npos) {
+      std::cout << "plan differs: " << fp.raw << std::endl << plan;
+      result = EXIT_FAILURE;
+    }
+  }
+
+  // On serial lines DA1 is sent as DECID.  The plan shows the bytes actually written.
+  if (auto r = terminal::replies::parse("DA1=6, SPEED=9600, TERM=vt102"); ! r || ! terminal::info::explain(*r).contains("DA1    answered   \\eZ\n")) {
+    std::cout << "serial plan does not use DECID" << std::endl;
+    result = EXIT_FAILURE;
+  }
+
+  // Modes reported by DECRQM are features.
+  if (auto r = terminal::replies::parse(fingerprint("MODES=?2048;2,?2026;2"));
+      ! r || ! terminal::info::classify(*r)->feature_set.contains(terminal::features::inband_resize)
+      || ! terminal::info::classify(*r)->feature_set.contains(terminal::features::synchronized_output)) {
+    std::cout << "modes 2048 and 2026 not recognized" << std::endl;
+    result = EXIT_FAILURE;
+  }
+  if (auto r = terminal::replies::parse(fingerprint("KEYBOARD=0"));
+      ! r || ! terminal::info::classify(*r)->feature_set.contains(terminal::features::kitty_keyboard)
+      || terminal::info::classify(*r)->feature_set.contains(terminal::features::inband_resize)) {
+    std::cout << "kitty keyboard protocol not recognized" << std::endl;
+    result = EXIT_FAILURE;
+  }
+
+  // The SGR readback decides about truecolor support, even against XTGETTCAP.
+  if (auto r = terminal::replies::parse(fingerprint("SGR=0;48:2:1:2:3m")); r) {
+    auto ti = terminal::info::classify(*r);
+    if (! ti->feature_set.contains(terminal::features::truecolor) || ti->color_depth != 24) {
+      std::cout << "truecolor not recognized" << std::endl;
+      result = EXIT_FAILURE;
+    }
+
+    r->tcap = "RGB";
+    r->sgr = "0;48;5;16m";
+    ti = terminal::info::classify(*r);
+    if (ti->feature_set.contains(terminal::features::truecolor) || ti->color_depth != 8) {
+      std::cout << "256 colors not recognized" << std::endl;
+      result = EXIT_FAILURE;
+    }
+
+    // A readback without the color is not conclusive.
+    r->sgr = "0m";
+    ti = terminal::info::classify(*r);
+    if (! ti->feature_set.contains(terminal::features::truecolor) || ti->color_depth != 24) {
+      std::cout << "truecolor from XTGETTCAP ignored" << std::endl;
+      result = EXIT_FAILURE;
+    }
+  } else
+    result = EXIT_FAILURE;
+
+  return result;
+}
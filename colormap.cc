@@ -0,0 +1,234 @@
+#include "colormap.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+#endif
+
+
+namespace terminal {
+
+  namespace {
+
+    // Each channel is divided into 16 ranges of 16 values.
+    constexpr unsigned cube_bits = 4;
+    constexpr unsigned cube_size = 1u << (8 - cube_bits);
+    constexpr unsigned ncubes = 1u << (3 * cube_bits);
+    // Description of a cube: either the only possible entry with this bit set, or the number of the first
+    // block of candidates shifted by six bits plus the number of blocks.
+    constexpr uint32_t single = 1u << 31;
+    constexpr unsigned count_bits = 6;
+
+
+    size_t cube_of(rgb c)
+    {
+      return size_t(c.r >> (8 - cube_bits)) << (2 * cube_bits) | size_t(c.g >> (8 - cube_bits)) << cube_bits | size_t(c.b >> (8 - cube_bits));
+    }
+
+
+    // The candidates are stored in blocks of eight bytes each for the red, green, and blue values, and the
+    // indices.  A block is half a cache line.
+    constexpr size_t block = 8;
+    constexpr size_t block_size = 4 * block;
+
+    using kernel_fn = uint8_t (*)(const uint8_t* blocks, size_t nblocks, rgb c);
+
+
+    // The distance and the index are combined so that a single minimum yields the nearest entry and, of
+    // equally near entries, the one with the lowest index.  The distance needs at most 18 bits.
+    uint8_t nearest_generic(const uint8_t* blocks, size_t nblocks, rgb c)
+    {
+      int32_t best = INT_MAX;
+      for (size_t n = 0; n < nblocks; ++n, blocks += block_size)
+        for (size_t i = 0; i < block; ++i) {
+          int32_t dr = blocks[i] - c.r;
+          int32_t dg = blocks[block + i] - c.g;
+          int32_t db = blocks[2 * block + i] - c.b;
+          best = std::min(best, (dr * dr + dg * dg + db * db) << 8 | blocks[3 * block + i]);
+        }
+      return uint8_t(best);
+    }
+
+
+#if defined(__x86_64__) || defined(__i386__)
+    [[gnu::target("avx2")]] __m256i load8(const uint8_t* p)
+    {
+      return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+    }
+
+
+    [[gnu::target("avx2")]] uint8_t nearest_avx2(const uint8_t* blocks, size_t nblocks, rgb c)
+    {
+      auto cr = _mm256_set1_epi32(c.r);
+      auto cg = _mm256_set1_epi32(c.g);
+      auto cb = _mm256_set1_epi32(c.b);
+      auto best = _mm256_set1_epi32(INT_MAX);
+
+      for (size_t n = 0; n < nblocks; ++n, blocks += block_size) {
+        auto dr = _mm256_sub_epi32(load8(blocks), cr);
+        auto dg = _mm256_sub_epi32(load8(blocks + block), cg);
+        auto db = _mm256_sub_epi32(load8(blocks + 2 * block), cb);
+        auto d = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dr, dr), _mm256_mullo_epi32(dg, dg)), _mm256_mullo_epi32(db, db));
+        best = _mm256_min_epi32(best, _mm256_or_si256(_mm256_slli_epi32(d, 8), load8(blocks + 3 * block)));
+      }
+
+      auto m = _mm_min_epi32(_mm256_castsi256_si128(best), _mm256_extracti128_si256(best, 1));
+      m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+      m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+      return uint8_t(_mm_cvtsi128_si32(m));
+    }
+
+
+    [[gnu::target("sse4.1")]] __m128i load4(const uint8_t* p)
+    {
+      int32_t v;
+      memcpy(&v, p, sizeof(v));
+      return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(v));
+    }
+
+
+    [[gnu::target("sse4.1")]] uint8_t nearest_sse41(const uint8_t* blocks, size_t nblocks, rgb c)
+    {
+      auto cr = _mm_set1_epi32(c.r);
+      auto cg = _mm_set1_epi32(c.g);
+      auto cb = _mm_set1_epi32(c.b);
+      auto best = _mm_set1_epi32(INT_MAX);
+
+      // Each block is handled in two halves.
+      for (size_t n = 0; n < 2 * nblocks; ++n) {
+        auto p = blocks + n / 2 * block_size + n % 2 * (block / 2);
+        auto dr = _mm_sub_epi32(load4(p), cr);
+        auto dg = _mm_sub_epi32(load4(p + block), cg);
+        auto db = _mm_sub_epi32(load4(p + 2 * block), cb);
+        auto d = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(dr, dr), _mm_mullo_epi32(dg, dg)), _mm_mullo_epi32(db, db));
+        best = _mm_min_epi32(best, _mm_or_si128(_mm_slli_epi32(d, 8), load4(p + 3 * block)));
+      }
+
+      best = _mm_min_epi32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(1, 0, 3, 2)));
+      best = _mm_min_epi32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(2, 3, 0, 1)));
+      return uint8_t(_mm_cvtsi128_si32(best));
+    }
+#endif
+
+
+    kernel_fn select_kernel()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      if (__builtin_cpu_supports("avx2"))
+        return nearest_avx2;
+      if (__builtin_cpu_supports("sse4.1"))
+        return nearest_sse41;
+#endif
+      return nearest_generic;
+    }
+
+
+    // Square of the smallest and largest distance of the value to the range [lo,hi].
+    int32_t near_dist(int32_t v, int32_t lo, int32_t hi)
+    {
+      auto d = v < lo ? lo - v : v > hi ? v - hi : 0;
+      return d * d;
+    }
+
+    int32_t far_dist(int32_t v, int32_t lo, int32_t hi)
+    {
+      auto d = std::max(v - lo, hi - v);
+      return d * d;
+    }
+
+  } // anonymous namespace
+
+
+  color_map::color_map(const info& ti, unsigned ncolors)
+  {
+    auto def = info::default_palette();
+    std::span<const rgb> palette = ti.palette.empty() ? std::span<const rgb>(def) : std::span<const rgb>(ti.palette);
+    init(palette.first(std::min<size_t>(ncolors, palette.size())));
+  }
+
+
+  color_map::color_map(std::span<const rgb> palette)
+  {
+    init(palette);
+  }
+
+
+  void color_map::init(std::span<const rgb> palette)
+  {
+    auto def = info::default_palette();
+    if (palette.empty())
+      palette = def;
+    palette = palette.first(std::min(palette.size(), def.size()));
+    nearest = select_kernel();
+
+    cubes.reserve(ncubes);
+    std::vector<int32_t> near(palette.size());
+    std::vector<size_t> found;
+    for (size_t cube = 0; cube < ncubes; ++cube) {
+      int32_t rlo = int32_t(cube >> (2 * cube_bits)) * cube_size;
+      int32_t glo = int32_t((cube >> cube_bits) % (1u << cube_bits)) * cube_size;
+      int32_t blo = int32_t(cube % (1u << cube_bits)) * cube_size;
+
+      // An entry can only be the nearest for a color in the cube if its smallest distance to the cube is
+      // not larger than the largest distance of some other entry.
+      int32_t limit = INT_MAX;
+      for (size_t i = 0; i < palette.size(); ++i) {
+        const auto& p = palette[i];
+        near[i] = near_dist(p.r, rlo, rlo + cube_size - 1) + near_dist(p.g, glo, glo + cube_size - 1) + near_dist(p.b, blo, blo + cube_size - 1);
+        limit = std::min(limit, far_dist(p.r, rlo, rlo + cube_size - 1) + far_dist(p.g, glo, glo + cube_size - 1) + far_dist(p.b, blo, blo + cube_size - 1));
+      }
+
+      found.clear();
+      for (size_t i = 0; i < palette.size(); ++i)
+        if (near[i] <= limit)
+          found.emplace_back(i);
+
+      // Only one entry is nearest for all colors in the cube.
+      if (found.size() == 1) {
+        cubes.emplace_back(single | uint32_t(found.front()));
+        continue;
+      }
+
+      // The last block is filled up by repeating the last candidate.
+      cubes.emplace_back(uint32_t(candidates.size() / block_size) << count_bits | uint32_t((found.size() + block - 1) / block));
+      for (size_t b = 0; b < found.size(); b += block) {
+        auto base = candidates.size();
+        candidates.resize(base + block_size);
+        for (size_t i = 0; i < block; ++i) {
+          const auto idx = found[std::min(b + i, found.size() - 1)];
+          candidates[base + i] = palette[idx].r;
+          candidates[base + block + i] = palette[idx].g;
+          candidates[base + 2 * block + i] = palette[idx].b;
+          candidates[base + 3 * block + i] = uint8_t(idx);
+        }
+      }
+    }
+  }
+
+
+  uint8_t color_map::operator()(rgb c) const
+  {
+    auto desc = cubes[cube_of(c)];
+    if ((desc & single) != 0)
+      return uint8_t(desc);
+    return nearest(candidates.data() + (desc >> count_bits) * block_size, desc % (1u << count_bits), c);
+  }
+
+
+  void color_map::map(std::span<const rgb> in, std::span<uint8_t> out) const
+  {
+    assert(out.size() >= in.size());
+
+    for (size_t i = 0; i < in.size(); ++i)
+      // Runs of the same color are common, e.g., for the background.
+      if (i > 0 && in[i] == in[i - 1])
+        out[i] = out[i - 1];
+      else
+        out[i] = (*this)(in[i]);
+  }
+
+} // namespace terminal
@@ -0,0 +1,46 @@
+#ifndef _COLORMAP_HH
+#define _COLORMAP_HH 1
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "termdetect.hh"
+
+
+namespace terminal {
+
+  // Map 24-bit colors to the index of the nearest palette entry, by the Euclidean distance in RGB
+  // space, for terminals without truecolor support.  Of several entries with the same distance the one
+  // with the lowest index is used.
+  //
+  // The color space is divided into cubes.  For each cube the entries which can be nearest to any
+  // color in it are computed in advance, usually only a handful.  Only these are compared, with AVX2 or
+  // SSE4.1 if the processor supports it.  Cubes with only one possible entry need no comparison.
+  struct color_map {
+    // Use the palette of the terminal if it was queried, the default palette otherwise.  Only the first
+    // NCOLORS entries are used, e.g., 16 for terminals with only the ANSI colors.
+    explicit color_map(const info& ti, unsigned ncolors = 256);
+    // Use the given palette with at most 256 entries.  The default palette is used if it is empty.
+    explicit color_map(std::span<const rgb> palette);
+
+    // Index of the entry nearest to the color.
+    uint8_t operator()(rgb c) const;
+    // Map all colors in IN.  OUT must have at least as many elements.
+    void map(std::span<const rgb> in, std::span<uint8_t> out) const;
+
+  private:
+    void init(std::span<const rgb> palette);
+
+    // The comparison of the candidates, selected for the processor.
+    uint8_t (*nearest)(const uint8_t* blocks, size_t nblocks, rgb c) = nullptr;
+    // Candidates of the cubes in blocks of eight, as many as are handled at once with AVX2.  The list of
+    // each cube is padded to whole blocks.
+    std::vector<uint8_t> candidates { };
+    // For each cube the only possible entry or where its candidates are.
+    std::vector<uint32_t> cubes { };
+  };
+
+} // namespace terminal
+
+#endif // colormap.hh
@@ -0,0 +1,83 @@
+#include "colormap.hh"
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+
+// Compare the color mapping with a plain search through the whole palette, for the default palette,
+// its ANSI colors alone, and a random palette with duplicates.
+
+namespace {
+
+  uint8_t search(std::span<const terminal::rgb> palette, terminal::rgb c)
+  {
+    int best = -1;
+    size_t res = 0;
+    for (size_t i = 0; i < palette.size(); ++i) {
+      auto dr = palette[i].r - c.r;
+      auto dg = palette[i].g - c.g;
+      auto db = palette[i].b - c.b;
+      auto d = dr * dr + dg * dg + db * db;
+      if (best == -1 || d < best) {
+        best = d;
+        res = i;
+      }
+    }
+    return uint8_t(res);
+  }
+
+
+  bool check(const char* name, std::span<const terminal::rgb> palette)
+  {
+    terminal::color_map cm(palette);
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<unsigned> dist(0, 255);
+    std::vector<terminal::rgb> colors;
+    for (size_t i = 0; i < 100'000; ++i)
+      colors.emplace_back(uint8_t(dist(rng)), uint8_t(dist(rng)), uint8_t(dist(rng)));
+    // The borders of the cubes and runs of the same color.
+    for (unsigned v : { 0, 15, 16, 127, 128, 255 })
+      for (unsigned i = 0; i < 3; ++i)
+        colors.emplace_back(uint8_t(v), uint8_t(255 - v), uint8_t(v));
+    for (const auto& p : palette)
+      colors.emplace_back(p);
+
+    std::vector<uint8_t> out(colors.size());
+    cm.map(colors, out);
+    for (size_t i = 0; i < colors.size(); ++i) {
+      auto expected = search(palette, colors[i]);
+      if (out[i] != expected || cm(colors[i]) != expected) {
+        std::cout << name << ": color " << unsigned(colors[i].r) << ',' << unsigned(colors[i].g) << ',' << unsigned(colors[i].b)
+                  << " mapped to " << unsigned(out[i]) << ", expected " << unsigned(expected) << std::endl;
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+} // anonymous namespace
+
+
+int main()
+{
+  int result = EXIT_SUCCESS;
+
+  auto def = terminal::info::default_palette();
+  if (! check("default", def) || ! check("ansi", std::span(def).first(16)))
+    result = EXIT_FAILURE;
+
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<unsigned> dist(0, 255);
+  std::vector<terminal::rgb> random(200);
+  for (auto& c : random)
+    c = terminal::rgb { uint8_t(dist(rng)), uint8_t(dist(rng)), uint8_t(dist(rng)) };
+  random[150] = random[10];
+  if (! check("random", random))
+    result = EXIT_FAILURE;
+
+  return result;
+}
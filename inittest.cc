@@ -1,11 +1,20 @@
 #include "termdetect.hh"
 
+#include <cstring>
 #include <iostream>
 
 
-int main()
+int main(int argc, char* argv[])
 {
-  auto ti = terminal::info::alloc();
+  std::shared_ptr<terminal::info> ti;
+  if (argc == 3 && strcmp(argv[1], "--replay") == 0) {
+    ti = terminal::info::replay(argv[2]);
+    if (! ti) {
+      std::cerr << "cannot read transcript " << argv[2] << std::endl;
+      return 1;
+    }
+  } else
+    ti = terminal::info::alloc();
 
   std::cout << "implementation         = " << ti->implementation_name() << std::endl;
   std::cout << "implementation version = " << ti->implementation_version << std::endl;
@@ -0,0 +1,6 @@
+# Alacritty, https://alacritty.org
+name alacritty
+term alacritty
+expect Alacritty
+reply \e[c \e[?6c
+reply \e[>c \e[>0;1301;1c
@@ -0,0 +1,14 @@
+# Contour, https://contour-terminal.org
+name contour
+term contour
+expect Contour
+expect-version 0.4.3
+reply \e[c \e[?65;1;4;6;9;15;22;28;29;314c
+reply \e[>c \e[>65;403;0c
+reply \e[=c \eP!|C0000000\e\\
+reply \e[>q \eP>|contour 0.4.3\e\\
+reply \eP+q544e\e\\ \eP1+r544e=\e\\
+reply \e[?2048$p \e[?2048;2$y
+reply \e[?2004$p \e[?2004;2$y
+reply \e[4$p \e[4;2$y
+reply \e[?2026$p \e[?2026;2$y
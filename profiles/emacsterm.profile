@@ -0,0 +1,5 @@
+# Emacs term-mode.  It only echoes the XTGETTCAP request.
+name emacsterm
+term eterm-color
+expect Emacs Term
+reply \eP+q544e\e\\ \eP+q544e\e\\
@@ -0,0 +1,4 @@
+# Eterm, https://github.com/mej/Eterm
+name eterm
+term Eterm
+expect ETerm
@@ -0,0 +1,12 @@
+# Foot, https://codeberg.org/dnkl/foot
+name foot
+term foot
+expect Foot
+expect-version 1.13.2
+reply \e[c \e[?62;4;22;28c
+reply \e[>c \e[>1;011302;0c
+reply \e[=c \eP!|464f4f54\e\\
+reply \e[>q \eP>|foot(1.13.2)\e\\
+reply \eP+q544e\e\\ \eP1+r544e=666F6F74\e\\
+reply \e[?2026$p \e[?2026;2$y
+reply \e[?u \e[?0u
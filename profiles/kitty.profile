@@ -0,0 +1,11 @@
+# Kitty, https://sw.kovidgoyal.net/kitty/
+name kitty
+term xterm-kitty
+expect Kitty
+expect-version 0.31.0
+reply \e[c \e[?62;c
+reply \e[>c \e[>1;4000;29c
+reply \e[>q \eP>|kitty(0.31.0)\e\\
+reply \eP+q544e\e\\ \eP1+r544e=787465726d2d6b69747479\e\\
+reply \e[?u \e[?0u
+reply \e[?2026$p \e[?2026;2$y
@@ -0,0 +1,9 @@
+# Konsole, https://konsole.kde.org
+name konsole
+term xterm-256color
+expect Konsole
+expect-version 23.08.1
+reply \e[c \e[?62;1;4c
+reply \e[>c \e[>1;115;0c
+reply \e[=c \eP!|7E4B4445\e\\
+reply \e[>q \eP>|Konsole 23.08.1\e\\
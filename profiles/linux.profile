@@ -0,0 +1,6 @@
+# Linux virtual console.  Only DA1 is answered.  Through a pseudo terminal it can only be told
+# apart from st by TERM.
+name linux
+term linux
+expect Linux console
+reply \e[c \e[?6c
@@ -0,0 +1,7 @@
+# mrxvt, https://materm.sourceforge.net
+name mrxvt
+term rxvt
+expect mrxvt
+expect-version 0.5.4
+reply \e[c \e[?1;2c
+reply \e[>c \e[>82;0.5.4;0c
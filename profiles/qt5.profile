@@ -0,0 +1,7 @@
+# QTermWidget based emulators, e.g., qterminal.  They echo the XTGETTCAP request.
+name qt5
+term xterm-256color
+expect Qt5
+reply \e[c \e[?1;2c
+reply \e[>c \e[>0;115;0c
+reply \eP+q544e\e\\ \eP+q544e\e\\
@@ -0,0 +1,8 @@
+# rxvt-unicode, http://software.schmorp.de/pkg/rxvt-unicode.html
+name rxvt
+term rxvt-unicode-256color
+expect rxvt
+expect-version 9.5
+reply \e[c \e[?1;2c
+reply \e[>c \e[>85;95;0c
+reply \e]702;?\e\\ \e]702;rxvt-unicode(9.31)\e
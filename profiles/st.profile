@@ -0,0 +1,5 @@
+# st, https://st.suckless.org
+name st
+term st-256color
+expect st
+reply \e[c \e[?6c
@@ -0,0 +1,9 @@
+# Terminology, https://www.enlightenment.org/about-terminology
+name terminology
+term xterm-256color
+expect Terminology
+expect-version 1.13.0
+reply \e[c \e[?64;1;9;15;18;21;22c
+reply \e[>c \e[>61;337;0c
+reply \e[=c \eP!|7E7E5459\e\\
+reply \e[>q \eP>|terminology 1.13.0\e\\
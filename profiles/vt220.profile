@@ -0,0 +1,9 @@
+# DEC VT220 on a serial line.  Only DA1, DECID, and DA2 are answered.  Nothing identifies a
+# particular implementation.
+name vt220
+term vt220
+expect unknown
+baud 9600
+reply \e[c \e[?62;1;2;6;7;8;9c
+reply \eZ \e[?62;1;2;6;7;8;9c
+reply \e[>c \e[>1;10;0c
@@ -0,0 +1,8 @@
+# VTE-based emulators, e.g., gnome-terminal
+name vte
+term xterm-256color
+expect VTE-based
+expect-version 0.76
+reply \e[c \e[?65;1;9c
+reply \e[>c \e[>65;7600;1c
+reply \e[=c \eP!|7E565445\e\\
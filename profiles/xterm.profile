@@ -0,0 +1,18 @@
+# XTerm, https://invisible-island.net/xterm/
+name xterm
+term xterm-256color
+expect XTerm
+expect-version 390
+reply \e[c \e[?64;1;2;6;9;15;16;17;18;21;22;28c
+reply \e[>c \e[>41;390;0c
+reply \e[=c \eP!|00000000\e\\
+reply \e[>q \eP>|XTerm(390)\e\\
+reply \e[14t \e[4;408;720t
+reply \e[16t \e[6;17;9t
+reply \eP+q524742\e\\ \eP0+r524742\e\\
+reply \eP+q5463\e\\ \eP0+r5463\e\\
+reply \eP$qm\e\\ \eP1$r0;48:2:1:2:3m\e\\
+reply \e]10;?\e\\ \e]10;rgb:0000/0000/0000\e\\
+reply \e]11;?\e\\ \e]11;rgb:ffff/ffff/ffff\e\\
+reply \e]4;1;?\e\\ \e]4;1;rgb:cdcd/0000/0000\e\\
+reply \e]4;4;?\e\\ \e]4;4;rgb:0000/0000/eeee\e\\
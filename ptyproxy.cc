@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <tuple>
+
+#include <error.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+
+// Run a program on a pseudo terminal which is connected to the real terminal through a link with
+// configurable one-way latency, jitter, bandwidth, and chunk size.  This allows to see how the
+// detection behaves with genuine emulator replies over a slow connection, e.g., an SSH session
+// across an ocean, while everything runs on the local machine.
+
+namespace {
+
+  using clock = std::chrono::steady_clock;
+
+
+  // Parameters of the simulated link.  They apply to both directions.
+  struct link_params {
+    double latency = 0.0;       // One-way delay in milliseconds.
+    double jitter = 0.0;        // Maximal random additional delay in milliseconds.
+    double bandwidth = 0.0;     // Bytes per second, zero means unlimited.
+    size_t chunk = 0;           // Maximal size of the pieces the data is split into, zero means no splitting.
+  };
+
+
+  // One direction of the link.  Data is delivered in order and not before the previous data.
+  struct channel {
+    channel(int in_, int out_, const link_params& params_, std::mt19937& rng_) : in(in_), out(out_), params(params_), rng(rng_) { }
+
+    // Read what is available on the input side and schedule it for delivery.  Returns false at the end of input.
+    bool receive();
+    // Write the data which is due.
+    void deliver();
+    // Time at which the next piece of data is due.
+    std::optional<clock::time_point> next_due() const { return queue.empty() ? std::nullopt : std::make_optional(std::get<clock::time_point>(queue.front())); }
+
+    int in;
+    int out;
+
+  private:
+    const link_params& params;
+    std::mt19937& rng;
+    std::deque<std::tuple<clock::time_point,std::string>> queue { };
+    // Time the link is free again, used to limit the bandwidth.
+    clock::time_point busy_until { };
+  };
+
+
+  bool channel::receive()
+  {
+    char buf[4096];
+    auto n = ::read(in, buf, sizeof(buf));
+    if (n <= 0)
+      return n < 0 && errno == EINTR;
+
+    auto now = clock::now();
+    std::string_view data(buf, n);
+    while (! data.empty()) {
+      auto len = params.chunk == 0 ? data.size() : std::min(params.chunk, data.size());
+
+      auto delay = params.latency;
+      if (params.jitter > 0.0)
+        delay += std::uniform_real_distribution<double>(0.0, params.jitter)(rng);
+      auto due = now + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double,std::milli>(delay));
+
+      if (params.bandwidth > 0.0) {
+        busy_until = std::max(busy_until, due) + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(len / params.bandwidth));
+        due = busy_until;
+      }
+      if (! queue.empty())
+        due = std::max(due, std::get<clock::time_point>(queue.back()));
+
+      queue.emplace_back(due, data.substr(0, len));
+      data.remove_prefix(len);
+    }
+
+    return true;
+  }
+
+
+  void channel::deliver()
+  {
+    auto now = clock::now();
+    while (! queue.empty() && std::get<clock::time_point>(queue.front()) <= now) {
+      const auto& data = std::get<std::string>(queue.front());
+      size_t done = 0;
+      while (done < data.size()) {
+        auto n = ::write(out, data.data() + done, data.size() - done);
+        if (n < 0 && errno != EINTR && errno != EAGAIN)
+          break;
+        if (n > 0)
+          done += n;
+      }
+      queue.pop_front();
+    }
+  }
+
+
+  volatile sig_atomic_t winch_seen = 0;
+
+  void winch_handler(int)
+  {
+    winch_seen = 1;
+  }
+
+
+  [[noreturn]] void usage(const char* prog)
+  {
+    std::cerr << "Usage: " << prog << " [-l LATENCY-MS] [-j JITTER-MS] [-b BYTES-PER-SEC] [-c CHUNK-SIZE] [-s SEED] [--] PROGRAM [ARG]...\n";
+    exit(EXIT_FAILURE);
+  }
+
+
+  termios saved_termios;
+
+  void restore_terminal()
+  {
+    ::tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+  }
+
+} // anonymous namespace
+
+
+int main(int argc, char* argv[])
+{
+  link_params params;
+  unsigned seed = std::random_device()();
+
+  int opt;
+  while ((opt = getopt(argc, argv, "+l:j:b:c:s:")) != -1)
+    switch (opt) {
+    case 'l':
+      params.latency = atof(optarg);
+      break;
+    case 'j':
+      params.jitter = atof(optarg);
+      break;
+    case 'b':
+      params.bandwidth = atof(optarg);
+      break;
+    case 'c':
+      params.chunk = std::max(0, atoi(optarg));
+      break;
+    case 's':
+      seed = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  if (optind == argc)
+    usage(argv[0]);
+
+  if (::tcgetattr(STDIN_FILENO, &saved_termios) != 0)
+    error(EXIT_FAILURE, errno, "standard input is not a terminal");
+  winsize ws;
+  if (::ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) != 0)
+    ws = winsize { 24, 80, 0, 0 };
+
+  int master;
+  auto pid = ::forkpty(&master, nullptr, &saved_termios, &ws);
+  if (pid == -1)
+    error(EXIT_FAILURE, errno, "cannot create pseudo terminal");
+  if (pid == 0) {
+    ::execvp(argv[optind], &argv[optind]);
+    error(127, errno, "cannot execute %s", argv[optind]);
+  }
+
+  // The real terminal is only a transport now, everything is interpreted on the inner side.
+  termios t_raw = saved_termios;
+  ::cfmakeraw(&t_raw);
+  ::tcsetattr(STDIN_FILENO, TCSAFLUSH, &t_raw);
+  atexit(restore_terminal);
+
+  // SIGWINCH is only delivered while waiting.
+  sigset_t block;
+  sigemptyset(&block);
+  sigaddset(&block, SIGWINCH);
+  sigset_t orig;
+  ::sigprocmask(SIG_BLOCK, &block, &orig);
+  struct sigaction sa { };
+  sa.sa_handler = winch_handler;
+  ::sigaction(SIGWINCH, &sa, nullptr);
+
+  std::mt19937 rng(seed);
+  channel down(master, STDOUT_FILENO, params, rng);
+  channel up(STDIN_FILENO, master, params, rng);
+  bool program_running = true;
+
+  while (program_running || down.next_due()) {
+    if (winch_seen) {
+      winch_seen = 0;
+      // The window size is not part of the byte stream, pass it on right away.
+      if (::ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == 0)
+        ::ioctl(master, TIOCSWINSZ, &ws);
+    }
+
+    std::optional<clock::time_point> due;
+    for (auto d : { down.next_due(), up.next_due() })
+      if (d && (! due || *d < *due))
+        due = d;
+    timespec ts;
+    timespec* tsp = nullptr;
+    if (due) {
+      auto left = std::max(*due - clock::now(), clock::duration::zero());
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+      ts.tv_sec = ns / 1'000'000'000;
+      ts.tv_nsec = ns % 1'000'000'000;
+      tsp = &ts;
+    }
+
+    pollfd pfds[2] {
+      { program_running ? master : -1, POLLIN, 0 },
+      { program_running ? STDIN_FILENO : -1, POLLIN, 0 },
+    };
+    auto n = ::ppoll(pfds, 2, tsp, &orig);
+    if (n < 0 && errno != EINTR)
+      break;
+
+    if (n > 0) {
+      if (pfds[0].revents != 0 && ! down.receive())
+        // The program terminated and the pseudo terminal is closed.
+        program_running = false;
+      if (pfds[1].revents != 0 && ! up.receive())
+        program_running = false;
+    }
+
+    down.deliver();
+    if (program_running)
+      up.deliver();
+  }
+
+  int status = 0;
+  ::kill(pid, SIGHUP);
+  ::waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
@@ -0,0 +1,220 @@
+#include "termdetect.hh"
+#include "termsim.hh"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/ioctl.h>
+
+
+// Run the detection against simulated emulators for all profiles in the directory given on the command
+// line.  Each profile is used once as is and once with fragmented and delayed replies.  The xterm profile is
+// also used for the geometry tracker, the palette, and fragmented DCS replies, the contour profile for the
+// mode queries.
+
+namespace {
+
+  bool check(const terminal::sim::profile& prof, const char* variant)
+  {
+    terminal::sim::simulator sim(prof);
+    if (sim.slave() == -1) {
+      std::cout << prof.name << ": cannot create pseudo terminal" << std::endl;
+      return false;
+    }
+
+    ::setenv("TERM", prof.term.c_str(), 1);
+    terminal::fd_transport tr(sim.slave());
+    auto ti = terminal::info::alloc(tr);
+
+    if (ti->implementation_name() != prof.expect || (! prof.expect_version.empty() && ti->implementation_version != prof.expect_version)) {
+      std::cout << prof.name << " (" << variant << "): got " << ti->implementation_name() << ' ' << ti->implementation_version
+                << ", expected " << prof.expect << ' ' << prof.expect_version << std::endl
+                << "  raw = " << ti->raw << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+
+
+  // The simulator's pseudo terminal has no pixel sizes, they have to be requested.
+  bool check_geometry(const terminal::sim::profile& prof)
+  {
+    terminal::sim::simulator sim(prof);
+    terminal::geometry_tracker tracker(sim.slave());
+
+    auto g = tracker.get();
+    if (g.columns != 80 || g.rows != 24 || g.cell_width != 9 || g.cell_height != 17 || g.width != 720 || g.height != 408) {
+      std::cout << "geometry: got " << g.columns << 'x' << g.rows << ", " << g.width << 'x' << g.height << " pixels" << std::endl;
+      return false;
+    }
+
+    winsize ws { };
+    ws.ws_row = 30;
+    ws.ws_col = 100;
+    ::ioctl(sim.slave(), TIOCSWINSZ, &ws);
+    ::raise(SIGWINCH);
+
+    g = tracker.get();
+    if (g.columns != 100 || g.rows != 30 || g.width != 900 || g.height != 510) {
+      std::cout << "geometry after resize: got " << g.columns << 'x' << g.rows << ", " << g.width << 'x' << g.height << " pixels" << std::endl;
+      return false;
+    }
+
+    // The profile does not support mode 2048.  The signal must still be used.
+    if (tracker.enable_inband_resize()) {
+      std::cout << "in-band resize enabled without support" << std::endl;
+      return false;
+    }
+    ws.ws_row = 25;
+    ::ioctl(sim.slave(), TIOCSWINSZ, &ws);
+    ::raise(SIGWINCH);
+    if ((g = tracker.get()).rows != 25) {
+      std::cout << "geometry after failed enable: got " << g.columns << 'x' << g.rows << std::endl;
+      return false;
+    }
+
+    // In-band reports are taken out of the input.
+    std::string input = "a\e[48;40;120;680;1080tb";
+    if (! tracker.process_input(input) || input != "ab" || (g = tracker.get()).columns != 120 || g.rows != 40 || g.width != 1080 || g.height != 680) {
+      std::cout << "in-band resize: got " << g.columns << 'x' << g.rows << ", " << g.width << 'x' << g.height << " pixels" << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+
+
+  // All modes are queried in one round trip.  Those the terminal does not answer for are not recognized.
+  bool check_modes(const terminal::sim::profile& prof)
+  {
+    terminal::sim::simulator sim(prof);
+    const terminal::mode modes[] { { 2004 }, { 4, false }, { 1049 } };
+    auto res = terminal::info::query_modes(modes, sim.slave());
+
+    if (res.size() != 3 || res[{ 2004 }] != terminal::mode_states::reset || res[{ 4, false }] != terminal::mode_states::reset
+        || res[{ 1049 }] != terminal::mode_states::not_recognized) {
+      std::cout << "modes: got " << res.size() << " results" << std::endl;
+      return false;
+    }
+
+    terminal::geometry_tracker tracker(sim.slave());
+    if (! tracker.enable_inband_resize()) {
+      std::cout << "in-band resize not enabled" << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+
+
+  // The replies batched with DA1 can end in the final byte of the DA1 reply.  Received byte by byte this
+  // must not end the read early.
+  bool check_fragmented_dcs(terminal::sim::profile prof)
+  {
+    prof.replies["\eP+q524742\e\\"] = "\eP1+r524742=3c\e\\";
+    prof.fragment = 1;
+    prof.fragment_delay = 1.0;
+
+    terminal::sim::simulator sim(prof);
+    ::setenv("TERM", prof.term.c_str(), 1);
+    terminal::fd_transport tr(sim.slave());
+    auto ti = terminal::info::alloc(tr);
+
+    auto timed_out = std::ranges::count_if(ti->probe_records, [](const auto& r) { return r.outcome == terminal::probe_outcomes::timed_out; });
+    if (ti->implementation_name() != prof.expect || ! ti->feature_set.contains(terminal::features::truecolor) || timed_out != 0) {
+      std::cout << "fragmented DCS: got " << ti->implementation_name() << ", " << timed_out << " timeouts" << std::endl
+                << "  raw = " << ti->raw << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+
+  // The profile has replies for only some palette entries, the others have the default values.
+  bool check_palette(const terminal::sim::profile& prof)
+  {
+    terminal::sim::simulator sim(prof);
+    ::setenv("TERM", prof.term.c_str(), 1);
+    terminal::fd_transport tr(sim.slave());
+    terminal::info::set_palette_query(true);
+    auto ti = terminal::info::alloc(tr);
+    terminal::info::set_palette_query(false);
+
+    auto def = terminal::info::default_palette();
+    if (ti->foreground != terminal::rgb { 0, 0, 0 } || ti->background != terminal::rgb { 255, 255, 255 } || ti->palette.size() != def.size()
+        || ! std::ranges::equal(ti->palette, def) || def[4] != terminal::rgb { 0, 0, 0xee } || def[196] != terminal::rgb { 255, 0, 0 }) {
+      std::cout << "palette: got " << ti->palette.size() << " entries" << std::endl;
+      return false;
+    }
+
+    // The colors are kept in the replies, cached results have them without another request.
+    auto r = terminal::replies::parse(ti->raw);
+    auto cached = r ? terminal::info::classify(*r) : nullptr;
+    if (! cached || cached->foreground != ti->foreground || cached->background != ti->background || cached->palette != ti->palette) {
+      std::cout << "palette: not restored from " << ti->raw << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+} // anonymous namespace
+
+
+int main(int argc, char* argv[])
+{
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " PROFILE-DIR\n";
+    return EXIT_FAILURE;
+  }
+
+  std::vector<std::filesystem::path> files;
+  for (const auto& e : std::filesystem::directory_iterator(argv[1]))
+    if (e.path().extension() == ".profile")
+      files.emplace_back(e.path());
+  std::ranges::sort(files);
+  if (files.empty()) {
+    std::cout << "no profiles found in " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // The simulator answers quickly.  Do not wait longer than needed for emulators which do not answer.
+  terminal::info::set_request_delay(50);
+
+  int result = EXIT_SUCCESS;
+
+  for (const auto& f : files) {
+    auto prof = terminal::sim::profile::load(f.c_str());
+    if (! prof) {
+      std::cout << "cannot load " << f << std::endl;
+      result = EXIT_FAILURE;
+      continue;
+    }
+
+    if (! check(*prof, "plain"))
+      result = EXIT_FAILURE;
+
+    prof->fragment = 3;
+    prof->fragment_delay = 1.0;
+    prof->jitter = 2.0;
+    if (! check(*prof, "fragmented"))
+      result = EXIT_FAILURE;
+  }
+
+  if (auto prof = terminal::sim::profile::load((std::filesystem::path(argv[1]) / "xterm.profile").c_str()); ! prof || ! check_geometry(*prof) || ! check_palette(*prof) || ! check_fragmented_dcs(*prof))
+    result = EXIT_FAILURE;
+  if (auto prof = terminal::sim::profile::load((std::filesystem::path(argv[1]) / "contour.profile").c_str()); ! prof || ! check_modes(*prof))
+    result = EXIT_FAILURE;
+
+  return result;
+}
@@ -0,0 +1,192 @@
+#include "termdetect.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <error.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+// Classify recorded fingerprints offline.  Each input line contains a string in the format of
+// info::raw, optionally preceded by an identifier and a tab character.  For every line one output
+// line is produced, in the same order, with the tab-separated fields
+//
+//   [identifier]  implementation  version  emulation  features
+//
+// The input is split into as many pieces as there are threads and the pieces are processed in parallel.
+//
+// With -e the lines are instead taken as assumed replies and the requests the detection would make
+// are shown, together with the decisions and the expected and worst case time.  Nothing is sent to
+// the terminal.  A line can consist of just TERM=... to see the plan for a silent emulator.
+
+namespace {
+
+  void classify_line(std::string& out, std::string_view line)
+  {
+    if (auto tab = line.rfind('\t'); tab != std::string_view::npos) {
+      out.append(line.substr(0, tab + 1));
+      line.remove_prefix(tab + 1);
+    }
+
+    auto r = terminal::replies::parse(line);
+    if (! r) {
+      out.append("<INVALID>\n");
+      return;
+    }
+
+    auto ti = terminal::info::classify(*r);
+    out.append(ti->implementation_name());
+    out.push_back('\t');
+    out.append(ti->implementation_version);
+    out.push_back('\t');
+    out.append(ti->emulation_name());
+    out.push_back('\t');
+    bool first = true;
+    for (auto f : ti->feature_set) {
+      if (! first)
+        out.push_back(' ');
+      out.append(terminal::info::feature_name(f));
+      first = false;
+    }
+    if (! ti->unknown_features.empty()) {
+      if (! first)
+        out.push_back(' ');
+      out.append(ti->unknown_features);
+    }
+    out.push_back('\n');
+  }
+
+
+  void classify_range(std::string& out, std::string_view data)
+  {
+    while (! data.empty()) {
+      auto nl = data.find('\n');
+      auto line = data.substr(0, nl);
+      data.remove_prefix(nl == std::string_view::npos ? data.size() : nl + 1);
+      if (line.ends_with('\r'))
+        line.remove_suffix(1);
+      if (! line.empty())
+        classify_line(out, line);
+    }
+  }
+
+
+  void explain_range(std::string& out, std::string_view data, std::chrono::microseconds rtt)
+  {
+    while (! data.empty()) {
+      auto nl = data.find('\n');
+      auto line = data.substr(0, nl);
+      data.remove_prefix(nl == std::string_view::npos ? data.size() : nl + 1);
+      if (line.ends_with('\r'))
+        line.remove_suffix(1);
+      if (line.empty())
+        continue;
+
+      if (auto tab = line.rfind('\t'); tab != std::string_view::npos) {
+        out.append(line.substr(0, tab));
+        out.append(":\n");
+        line.remove_prefix(tab + 1);
+      }
+
+      if (auto r = terminal::replies::parse(line); r)
+        out.append(terminal::info::explain(*r, rtt));
+      else
+        out.append("<INVALID>\n");
+      out.push_back('\n');
+    }
+  }
+
+} // anonymous namespace
+
+
+int main(int argc, char* argv[])
+{
+  unsigned nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+  bool explain = false;
+  std::chrono::microseconds rtt { };
+
+  int opt;
+  while ((opt = getopt(argc, argv, "j:er:")) != -1)
+    switch (opt) {
+    case 'j':
+      nthreads = std::max(1, atoi(optarg));
+      break;
+    case 'e':
+      explain = true;
+      break;
+    case 'r':
+      rtt = std::chrono::microseconds(std::llround(atof(optarg) * 1000.0));
+      break;
+    default:
+      std::cerr << "Usage: " << argv[0] << " [-j THREADS] [-e [-r RTT-MS]] [FILE]\n";
+      return 1;
+    }
+
+  // Map the input file or, for standard input, read everything.
+  std::string buffer;
+  std::string_view data;
+  if (optind < argc && strcmp(argv[optind], "-") != 0) {
+    int fd = ::open(argv[optind], O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      error(EXIT_FAILURE, errno, "cannot open %s", argv[optind]);
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+      error(EXIT_FAILURE, errno, "cannot stat %s", argv[optind]);
+    if (st.st_size > 0) {
+      auto p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+      if (p == MAP_FAILED)
+        error(EXIT_FAILURE, errno, "cannot map %s", argv[optind]);
+      data = std::string_view(static_cast<const char*>(p), st.st_size);
+    }
+    ::close(fd);
+  } else {
+    char buf[65536];
+    ssize_t n;
+    while ((n = ::read(STDIN_FILENO, buf, sizeof(buf))) > 0)
+      buffer.append(buf, n);
+    data = buffer;
+  }
+
+  if (explain) {
+    std::string out;
+    explain_range(out, data, rtt);
+    std::cout.write(out.data(), out.size());
+    return 0;
+  }
+
+  // Split the input at line boundaries.
+  std::vector<std::string_view> pieces;
+  auto piece_size = data.size() / nthreads + 1;
+  while (! data.empty()) {
+    auto nl = data.find('\n', std::min(piece_size, data.size()) - 1);
+    auto len = nl == std::string_view::npos ? data.size() : nl + 1;
+    pieces.emplace_back(data.substr(0, len));
+    data.remove_prefix(len);
+  }
+
+  std::vector<std::string> results(pieces.size());
+  {
+    std::vector<std::jthread> threads;
+    for (size_t i = 1; i < pieces.size(); ++i)
+      threads.emplace_back(classify_range, std::ref(results[i]), pieces[i]);
+    if (! pieces.empty())
+      classify_range(results[0], pieces[0]);
+  }
+
+  for (const auto& r : results)
+    std::cout.write(r.data(), r.size());
+}
@@ -0,0 +1,195 @@
+#include "termdetect.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include <getopt.h>
+
+
+// Command line interface to the detection.  The result is printed as a JSON object, as shell
+// commands exporting TERMDETECT_* variables suitable for eval, or as a single field.  Unless -n is
+// given the per-user cache is used so that only the first call for a terminal makes requests.  With
+// -i the results for the terminal are removed from the cache and the daemon instead.
+
+namespace {
+
+  enum struct formats {
+    json,
+    shell,
+    field,
+  };
+
+
+  const char* const field_names[] {
+    "implementation",
+    "version",
+    "emulation",
+    "features",
+    "raw",
+    "columns",
+    "rows",
+  };
+
+
+  std::string get_field(const terminal::info& ti, std::string_view name)
+  {
+    if (name == "implementation")
+      return ti.implementation_name();
+    if (name == "version")
+      return ti.implementation_version;
+    if (name == "emulation")
+      return ti.emulation_name();
+    if (name == "features") {
+      std::string res;
+      for (auto f : ti.feature_set) {
+        if (! res.empty())
+          res += ' ';
+        res += terminal::info::feature_name(f);
+      }
+      if (! ti.unknown_features.empty()) {
+        if (! res.empty())
+          res += ' ';
+        res += ti.unknown_features;
+      }
+      return res;
+    }
+    if (name == "raw")
+      return ti.raw;
+
+    auto [col,row] = ti.get_geometry(ti.get_fd()).value_or(std::make_tuple(80u, 24u));
+    return std::format("{}", name == "columns" ? col : row);
+  }
+
+
+  std::string json_quote(std::string_view sv)
+  {
+    std::string res = "\"";
+    for (auto c : sv)
+      if (c == '"' || c == '\\') {
+        res += '\\';
+        res += c;
+      } else if (static_cast<unsigned char>(c) < ' ')
+        res += std::format("\\u{:04x}", unsigned(c));
+      else
+        res += c;
+    res += '"';
+    return res;
+  }
+
+
+  std::string shell_quote(std::string_view sv)
+  {
+    std::string res = "'";
+    for (auto c : sv)
+      if (c == '\'')
+        res += "'\\''";
+      else
+        res += c;
+    res += '\'';
+    return res;
+  }
+
+
+  [[noreturn]] void usage(const char* prog)
+  {
+    std::cerr << "Usage: " << prog << " [-j|--json] [-s|--shell] [-f|--field FIELD] [-n|--no-cache] [-i|--invalidate]\n";
+    exit(EXIT_FAILURE);
+  }
+
+} // anonymous namespace
+
+
+int main(int argc, char* argv[])
+{
+  static const option longopts[] {
+    { "json", no_argument, nullptr, 'j' },
+    { "shell", no_argument, nullptr, 's' },
+    { "field", required_argument, nullptr, 'f' },
+    { "no-cache", no_argument, nullptr, 'n' },
+    { "invalidate", no_argument, nullptr, 'i' },
+    { nullptr, 0, nullptr, 0 },
+  };
+
+  auto format = formats::json;
+  const char* field = nullptr;
+  bool cache = true;
+  bool invalidate = false;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "jsf:ni", longopts, nullptr)) != -1)
+    switch (opt) {
+    case 'j':
+      format = formats::json;
+      break;
+    case 's':
+      format = formats::shell;
+      break;
+    case 'f':
+      format = formats::field;
+      field = optarg;
+      if (std::ranges::find_if(field_names, [field](const char* n) { return strcmp(n, field) == 0; }) == std::end(field_names)) {
+        std::cerr << argv[0] << ": unknown field " << field << std::endl;
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'n':
+      cache = false;
+      break;
+    case 'i':
+      invalidate = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  if (optind != argc)
+    usage(argv[0]);
+
+  if (invalidate) {
+    terminal::info::invalidate();
+    return EXIT_SUCCESS;
+  }
+
+  terminal::info::set_cache(cache);
+  auto ti = terminal::info::alloc(false);
+  if (ti->get_fd() == -1) {
+    std::cerr << argv[0] << ": no terminal" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::string out;
+  switch (format) {
+  case formats::json:
+    out = "{";
+    for (auto name : field_names) {
+      if (out.size() > 1)
+        out += ',';
+      auto val = get_field(*ti, name);
+      if (strcmp(name, "columns") == 0 || strcmp(name, "rows") == 0)
+        out += std::format("\"{}\":{}", name, val);
+      else
+        out += std::format("\"{}\":{}", name, json_quote(val));
+    }
+    out += "}\n";
+    break;
+  case formats::shell:
+    for (auto name : field_names) {
+      std::string var = "TERMDETECT_";
+      for (auto p = name; *p != '\0'; ++p)
+        var += char(toupper(*p));
+      out += std::format("export {}={}\n", var, shell_quote(get_field(*ti, name)));
+    }
+    break;
+  case formats::field:
+    out = get_field(*ti, field) + '\n';
+    break;
+  }
+  ti->close();
+
+  std::cout << out;
+}
@@ -1,34 +1,62 @@
 #include "termdetect.hh"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <chrono>
+#include <climits>
+#include <cstdint>
 #include <cstring>
 #include <format>
 #include <map>
+#include <mutex>
 #include <optional>
+#include <ranges>
+#include <set>
+#include <span>
 #include <string_view>
 #include <system_error>
+#include <thread>
 #include <utility>
+#include <vector>
 
+#include <dirent.h>
 #include <fcntl.h>
+#include <linux/kd.h>
+#include <linux/serial.h>
 #include <paths.h>
 #include <poll.h>
 #include <termios.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/un.h>
+#include <sys/utsname.h>
+
+#if __has_include(<sys/sdt.h>)
+# include <sys/sdt.h>
+// Static tracepoints for use with bpftrace, perf, etc.  Each is a single nop unless it is traced.
+# define TRACEPOINT(name, ...) STAP_PROBEV(termdetect, name __VA_OPT__(,) __VA_ARGS__)
+#else
+# define TRACEPOINT(name, ...) do { } while (0)
+#endif
 
 
 namespace terminal {
 
   namespace {
 
-    // Special string to indicate that the command never was issued.
-    constexpr auto not_issued = "<NOT ISSUED>";
-    constexpr auto no_reply = "<NO REPLY>";
-
-
     struct info_impl final : info {
+      info_impl() = default;
       info_impl(bool close_fd);
+      info_impl(transport& tr);
+      info_impl(const replies& r);
 
       std::string da1_reply = not_issued;
       std::string da2_reply = not_issued;
@@ -37,25 +65,63 @@ namespace terminal {
       std::string q_reply = not_issued;
       std::string tn_reply = not_issued;
       std::string osc702_reply = not_issued;
+      std::string modes_reply = not_issued;
+      std::string keyboard_reply = not_issued;
+      std::string tcap_reply = not_issued;
+      std::string sgr_reply = not_issued;
+      // The colors in the compact form used in info::raw, see query_colors.
+      std::string colors_reply = not_issued;
+      // Value of the COLORTERM environment variable.  Unlike the replies it is not part of info::raw.
+      std::string colorterm { };
+      // Line speed of a serial line, zero for other terminals.  The timeout heuristics for emulators do not
+      // apply to serial lines.
+      unsigned line_speed = 0;
 
       bool da2_alarmed = false;
 
+      // If the kernel does not know the size of the terminal it is requested together with DA1.
+      bool want_geometry = false;
+      std::optional<std::tuple<unsigned,unsigned>> text_area { };
+
+      // Start of the detection, the time base for the probe records.
+      std::chrono::steady_clock::time_point detection_start { };
+
       // Version number derived from DA2 reply.
       unsigned vn = 0;
 
       // Intermediate result, the emulation announced by DA2.
       emulations da2_emulation = emulations::unknown;
 
+      // For info::explain the decisions are collected, together with the number of requests made before.
+      bool record_decisions = false;
+      std::vector<std::tuple<size_t,const char*>> decisions { };
+
 
-      void make_da1_request(int fd);
-      bool make_da2_request(int fd);
-      void make_da3_request(int fd);
-      void make_tn_request(int fd);
-      void make_q_request(int fd);
-      void make_osc702_request(int fd);
+      void make_da1_request(transport& tr);
+      bool make_da2_request(transport& tr);
+      void make_da3_request(transport& tr);
+      void make_tn_request(transport& tr);
+      void make_q_request(transport& tr);
+      void make_osc702_request(transport& tr);
 
       void parse_da1();
       void parse_da2();
+      void parse_modes();
+      void parse_keyboard();
+      void parse_color();
+      void parse_colors();
+      void query_colors(transport& tr);
+
+      bool make_request(std::string& res, transport& tr, probes probe, const char* request, const char* reply_prefix, const char* reply_suffix);
+
+      void detect(transport& tr);
+      void from_replies(const replies& r);
+      void format_raw();
+      void identify_silent(const char* term);
+      void classify();
+      void account() const;
+      void log_unknown(transport& tr) const;
+      void decision(const char* what);
 
       bool is_st() const;
       bool is_alacritty() const;
@@ -70,6 +136,7 @@ namespace terminal {
       bool is_konsole() const;
       bool is_eterm() const;
       bool is_qt5() const;
+      bool is_linuxconsole() const;
     };
 
 
@@ -99,6 +166,53 @@ namespace terminal {
 #define DA2_REPLY_PREFIX CSI ">"
 #define DA2_REPLY_SUFFIX "c"
 
+// Size of the text area in characters (CSI 18 t) and, for terminals which do not implement that, the
+// position of the cursor after moving it to the bottom right corner (CPR).  The cursor is restored.
+#define GEOMETRY_REQUEST CSI "18t" "\e7" CSI "999;999H" CSI "6n" "\e8"
+#define WINOP_REPLY_SUFFIX "t"
+#define CPR_REPLY_SUFFIX "R"
+#define TEXT_AREA_REPLY 8
+
+// Size of the text area and of a character cell in pixels.
+#define PIXELS_REQUEST CSI "14t" CSI "16t"
+#define TEXT_AREA_PIXELS_REPLY 4
+#define CELL_PIXELS_REPLY 6
+
+// DECRQM, request the state of a mode.  Modes in the DEC private range are prefixed with '?'.
+#define DECRQM_REQUEST_SUFFIX "$p"
+#define DECRQM_REPLY_SUFFIX "$y"
+
+// In-band window resize notifications, CSI 48 ; ROWS ; COLUMNS ; HEIGHT ; WIDTH t.
+#define INBAND_RESIZE_MODE "?2048"
+#define INBAND_RESIZE_REPLY 48
+
+// Kitty keyboard protocol, the reply contains the enabled progressive enhancement flags.
+#define KEYBOARD_REQUEST CSI "?u"
+#define KEYBOARD_REPLY_PREFIX CSI "?"
+#define KEYBOARD_REPLY_SUFFIX "u"
+
+// Truecolor support is checked in three ways.  XTGETTCAP for the RGB and Tc capabilities, and DECRQSS for
+// the SGR attributes after setting a direct color.  The terminal must not round the color to the palette.
+// The attributes are restored with DECRC.
+#define TCAP_RGB "524742"
+#define TCAP_TC "5463"
+#define TCAP_REPLY_PREFIX DCS "1+r"
+#define TCAP_NOT_FOUND DCS "0+r"
+#define DIRECT_COLOR "1:2:3"
+#define COLOR_REQUEST DCS "+q" TCAP_RGB ST DCS "+q" TCAP_TC ST "\e7" CSI "48;2;1;2;3m" DCS "$qm" ST "\e8"
+#define DECRQSS_REPLY_PREFIX DCS "1$r"
+#define DECRQSS_INVALID DCS "0$r"
+
+// Dynamic colors and palette entries.  The replies have the form OSC 10 ; rgb:RRRR/GGGG/BBBB ST and
+// OSC 4 ; N ; rgb:RRRR/GGGG/BBBB ST.  Some emulators use BEL instead of ST.
+#define FOREGROUND_REQUEST OSC "10;?" ST
+#define BACKGROUND_REQUEST OSC "11;?" ST
+#define PALETTE_REQUEST_FMT OSC "4;{};?" ST
+#define BEL "\a"
+
+// DECID is the predecessor of DA1.  It is shorter and also understood by the oldest terminals.
+#define DECID_REQUEST "\eZ"
+
 #define DA3_REQUEST CSI "=c"
 #define DA3_REPLY_PREFIX DCS "!|"
 #define DA3_REPLY_SUFFIX ST
@@ -158,9 +272,45 @@ namespace terminal {
     };
 
 
+    // Names of the fields in info::raw and the corresponding members of the replies structure.
+    const std::array known_reply_fields {
+      std::make_tuple("TN", &replies::tn),
+      std::make_tuple("DA1", &replies::da1),
+      std::make_tuple("DA2", &replies::da2),
+      std::make_tuple("DA3", &replies::da3),
+      std::make_tuple("OSC702", &replies::osc702),
+      std::make_tuple("Q", &replies::q),
+      std::make_tuple("MODES", &replies::modes),
+      std::make_tuple("KEYBOARD", &replies::keyboard),
+      std::make_tuple("TCAP", &replies::tcap),
+      std::make_tuple("SGR", &replies::sgr),
+      std::make_tuple("SPEED", &replies::speed),
+      std::make_tuple("COLORS", &replies::colors),
+      std::make_tuple("TERM", &replies::term),
+    };
+
+
     // Timeout for individual requests in case the emulator does not answer.
     std::optional<int> request_delay;
 
+    // Upper limit of the length of the replies.  On serial lines the time to transmit this much is added to the timeout.
+    constexpr size_t max_reply_size = 64;
+
+    // The bit rates of the speed_t values.
+    const std::tuple<speed_t,unsigned> known_speeds[] {
+      { B300, 300 }, { B600, 600 }, { B1200, 1200 }, { B2400, 2400 }, { B4800, 4800 }, { B9600, 9600 }, { B19200, 19200 },
+      { B38400, 38400 }, { B57600, 57600 }, { B115200, 115200 }, { B230400, 230400 }, { B460800, 460800 }, { B500000, 500000 },
+      { B576000, 576000 }, { B921600, 921600 }, { B1000000, 1000000 }, { B1152000, 1152000 }, { B1500000, 1500000 },
+      { B2000000, 2000000 }, { B2500000, 2500000 }, { B3000000, 3000000 }, { B3500000, 3500000 }, { B4000000, 4000000 },
+    };
+
+
+    // Time to transmit the bytes at the given speed, with start and stop bits, rounded up.
+    int transmission_time(unsigned speed, size_t nbytes)
+    {
+      return speed == 0 ? 0 : int((nbytes * 10 * 1000 + speed - 1) / speed);
+    }
+
     int get_default_request_delay()
     {
       // So far we only handle remote sessions special.  Recognize them by the DISPLAY envvar.
@@ -175,371 +325,1799 @@ namespace terminal {
     }
 
 
-    // Issue the request to the termi
-    bool make_request(std::string& res, int fd, const char* request, const char* reply_prefix, const char* reply_suffix)
-    {
-      bool wok = false;
-      bool rok = false;
-
-      termios t_old;
-      ::tcgetattr(fd, &t_old);
-      termios t_new = t_old;
-      ::cfmakeraw(&t_new);
-      ::tcsetattr(fd, TCSAFLUSH, &t_new);
+    // Process-wide statistics of the detections.  The counters are updated without locks.
+    constexpr size_t max_implementations = 32;
+    // Upper bounds of the buckets of the latency histogram in milliseconds.
+    constexpr std::array latency_buckets { 1u, 2u, 5u, 10u, 25u, 50u, 100u, 250u, 500u, 1000u, 2500u };
 
-      if (::write(fd, request, strlen(request)) == ssize_t(strlen(request))) [[likely]] {
-        wok = true;
+    struct {
+      std::atomic<uint64_t> detections[max_implementations] { };
+      std::atomic<uint64_t> requests[max_implementations] { };
+      std::atomic<uint64_t> timeouts[max_implementations] { };
+      // One more bucket for larger values.
+      std::atomic<uint64_t> latency[latency_buckets.size() + 1] { };
+      std::atomic<uint64_t> latency_sum_ns { };
+      std::atomic<uint64_t> cache_hits { };
+    } counters;
 
-        pollfd pfds[1] {
-          { fd, POLLIN, 0 }
-        };
-        auto n = ::poll(pfds, 1, *request_delay);
-        rok = n != 0;
-        if (rok) {
-          char buf[4096];
-          auto nread = ::read(fd, buf, sizeof(buf));
 
-          rok = nread > 0;
-          if (rok) [[likely]] {
-            res.clear();
-            for (decltype(nread) i = 0; i < nread; ++i)
-              res.push_back(buf[i]);
-          }
+    void write_metrics_file()
+    {
+      auto fname = std::getenv("TERMDETECT_METRICS");
+      if (fname == nullptr || fname[0] == '\0')
+        return;
+
+      std::string path;
+      for (std::string_view sv = fname; ! sv.empty(); sv.remove_prefix(1))
+        if (sv.starts_with("%p")) {
+          path += std::to_string(::getpid());
+          sv.remove_prefix(1);
         } else
-          res = no_reply;
-      }
-
-      ::tcsetattr(fd, TCSAFLUSH, &t_old);
+          path += sv[0];
 
-      if (wok && rok) {
-        // Strip out the expected prefix and suffix.
-        if (res.size() > strlen(reply_prefix) + strlen(reply_suffix) && res.starts_with(reply_prefix) && res.ends_with(reply_suffix)) [[likely]]
-          res = res.substr(strlen(reply_prefix), res.size() - (strlen(reply_suffix)) - (strlen(reply_prefix)));
+      auto data = info::metrics(path.ends_with(".json") ? metrics_formats::json : metrics_formats::prometheus);
+      int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+      if (fd != -1) {
+        (void) ::write(fd, data.data(), data.size());
+        ::close(fd);
       }
-
-      return ! rok;
     }
 
 
-    void info_impl::make_da1_request(int fd)
+    // Name of the file to record the exchange with the terminal in.
+    std::optional<std::string> transcript_file;
+
+    const char* get_transcript_file()
     {
-      (void) make_request(da1_reply, fd, DA1_REQUEST, DA1_REPLY_PREFIX, DA1_REPLY_SUFFIX);
+      if (transcript_file.has_value())
+        return transcript_file->empty() ? nullptr : transcript_file->c_str();
 
-      parse_da1();
+      auto fname = std::getenv("TERMDETECT_TRANSCRIPT");
+      return fname != nullptr && fname[0] != '\0' ? fname : nullptr;
     }
 
 
-    void info_impl::parse_da1()
+    // Whether the result of the detection is kept in the per-user cache.
+    std::optional<bool> use_cache;
+
+    bool get_use_cache()
     {
-      std::string_view sv = da1_reply;
+      if (use_cache.has_value())
+        return *use_cache;
 
-      // Remove the terminal prefix from DA1 reply.  Some emulators (e.g., Terminology)
-      // are inconsistent in the announcement of the terminal type in the DA2 and DA1
-      // replies.  Give preference to the former.
-      for (const auto& e : known_emulations)
-        if (sv.starts_with(std::get<const char*>(e))) {
-          if (emulation == emulations::unknown || emulation == emulations::vt100)
-            emulation = std::get<emulations>(e);
-          sv.remove_prefix(strlen(std::get<const char*>(e)));
-          break;
-        } else if (sv.size() == strlen(std::get<const char*>(e)) - 1 && strncmp(sv.data(), std::get<const char*>(e), sv.size()) == 0) {
-          // Some terminals just announce the emulation and therefore do not have the trailing semicolon
-          // present in the known_emulation table.
-          if (emulation == emulations::unknown)
-            emulation = std::get<emulations>(e);
-          sv.remove_prefix(sv.size());
-          break;
-        }
+      auto val = std::getenv("TERMDETECT_CACHE");
+      return val != nullptr && val[0] == '1';
+    }
 
-      while (! sv.empty()) {
-        unsigned code;
-        auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), code);
-        if (ec != std::errc{ } || ! (ptr == sv.data() + sv.size() || ptr[0] == ';'))
-          break;
-        if (ptr[0] != '\0')
-          ++ptr;
-        if (auto feature = known_features.find(code); feature != known_features.end())
-          feature_set.insert(feature->second);
-        else
-          unknown_features += std::string(sv.data(), ptr - sv.data());
-        sv.remove_prefix(ptr - sv.data());
-      }
 
-      if (unknown_features.ends_with(";"))
-        unknown_features.erase(unknown_features.size() - 1);
-    }
+    // The cache consists of one file per terminal device.  The first line identifies the format, the second the device
+    // instance, and the third contains the replies in the format of info::raw plus the TERM value.  Since the replies are
+    // cached and not the result, changes to the classification take effect immediately.
+    constexpr std::string_view cache_magic { "termdetect-cache 1\n" };
 
 
-    bool info_impl::make_da2_request(int fd)
+    // Directory for the cache and the socket of the daemon.  Empty if no safe directory is available.  Only those
+    // which store something there create it, looking something up does not leave traces behind.
+    std::string get_runtime_dir(bool create = false)
     {
-      bool rfailed = make_request(da2_reply, fd, DA2_REQUEST, DA2_REPLY_PREFIX, DA2_REPLY_SUFFIX);
+      std::string dir;
+      if (auto rundir = std::getenv("XDG_RUNTIME_DIR"); rundir != nullptr && rundir[0] == '/')
+        dir = std::format("{}/termdetect", rundir);
+      else
+        dir = std::format("/tmp/termdetect-{}", ::getuid());
 
-      parse_da2();
+      // Do not use a directory others can write to.
+      struct stat dst;
+      if (::lstat(dir.c_str(), &dst) != 0) {
+        if (! create || errno != ENOENT || ::mkdir(dir.c_str(), 0700) != 0 || ::lstat(dir.c_str(), &dst) != 0)
+          return { };
+      }
+      if (! S_ISDIR(dst.st_mode) || dst.st_uid != ::getuid() || (dst.st_mode & 077) != 0)
+        return { };
 
-      return rfailed;
+      return dir;
     }
 
 
-    void info_impl::parse_da2()
+    // Name of the cache file for the terminal device.
+    std::string get_cache_file(const struct stat& st, bool create = false)
     {
-      std::string_view sv = da2_reply;
+      auto dir = get_runtime_dir(create);
+      return dir.empty() ? dir : std::format("{}/{:x}", dir, st.st_rdev);
+    }
 
-      bool matched = false;
-      for (const auto& e : known_emulations)
-        if (sv.starts_with(std::get<const char*>(e))) {
-          da2_emulation = emulation = std::get<emulations>(e);
-          sv.remove_prefix(strlen(std::get<const char*>(e)));
-          matched = true;
-          break;
-        }
 
-      if (! matched && sv.starts_with("1;"))
-        // This is the non-descript answer of VT220 etc which refer to DA1 for the real answer.
-        // Only the rest of the information is important.
-        sv.remove_prefix(2);
+    // The device number alone is not sufficient, pseudo terminals are reused.  A new device node is created every time,
+    // though, and the change time is set.
+    std::string get_cache_key(const struct stat& st)
+    {
+      return std::format("{:x} {}.{:09}\n", st.st_rdev, st.st_ctim.tv_sec, st.st_ctim.tv_nsec);
+    }
 
-      // The DA2 reply consists of the version information.  Usually separated by semicolons.
-      auto skip = sv.find(';');
-      auto svend = sv.data() + (skip == std::string_view::npos ? sv.size() : skip);
-      auto [endp, ec] = std::from_chars(sv.data(), svend, vn);
-      if (ec == std::errc { }) {
-        if (endp < svend && *endp == '.') {
-          do {
-            unsigned vn2;
-            auto [endp2, ec2] = std::from_chars(endp + 1, svend, vn2);
-            endp = endp2;
-            ec = ec2;
-          } while (ec == std::errc { } && endp < svend && *endp == '.');
-          if (ec == std::errc { } && (endp == svend || *endp == ';'))
-            implementation_version = std::string(sv.data(), endp);
 
-          sv.remove_prefix(endp - sv.data());
-          if (sv == ";0")
-            return;
-        } else
-          sv.remove_prefix(endp - sv.data());
+    std::optional<replies> cache_lookup(const std::string& fname, const std::string& key)
+    {
+      int fd = ::open(fname.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+      if (fd == -1)
+        return std::nullopt;
+      char buf[4096];
+      auto n = ::read(fd, buf, sizeof(buf));
+      ::close(fd);
+      if (n <= 0)
+        return std::nullopt;
 
-        da2_reply_tail = sv;
-        if (sv[0] == ';') {
-          unsigned vn2;
-          auto [endp2, ec2] = std::from_chars(sv.data() + 1, sv.data() + sv.size(), vn2);
+      std::string_view sv(buf, n);
+      if (! sv.starts_with(cache_magic))
+        return std::nullopt;
+      sv.remove_prefix(cache_magic.size());
+      if (! sv.starts_with(key) || ! sv.ends_with('\n'))
+        return std::nullopt;
+      sv.remove_prefix(key.size());
+      sv.remove_suffix(1);
 
-          // Terminal emulators do not agree how to encode the version number.  Some encode all the data in the number
-          // after the first semicolon.  Others use the second semicolon as a decimal point.  Yet others use floating-point
-          // notation.  Try to guess.
-          if (ec2 == std::errc { } && vn < 10000 && vn2 != 0 && vn2 < 100) {
-            vn = vn * 100 + vn2;
-            sv.remove_prefix(endp2 - sv.data());
-            da2_reply_tail = sv;
-          }
-          // Many emulators add ";0" at the end.  Ignore it.
-          if (da2_reply_tail == ";0")
-            da2_reply_tail = "";
-        }
-      }
+      return replies::parse(sv);
     }
 
 
-    void info_impl::make_da3_request(int fd)
+    void cache_store(const std::string& fname, const std::string& key, const std::string& raw, const char* term)
     {
-      (void) make_request(da3_reply, fd, DA3_REQUEST, DA3_REPLY_PREFIX, DA3_REPLY_SUFFIX);
+      // Replace the file atomically, concurrent readers must not see partial content.
+      auto tmpname = std::format("{}.{}", fname, ::getpid());
+      int fd = ::open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+      if (fd == -1)
+        return;
+      auto data = std::format("{}{}{}, TERM={}\n", cache_magic, key, raw, term ?: "");
+      bool ok = ::write(fd, data.data(), data.size()) == ssize_t(data.size());
+      ::close(fd);
+      if (! ok || ::rename(tmpname.c_str(), fname.c_str()) != 0)
+        ::unlink(tmpname.c_str());
     }
 
-    void info_impl::make_tn_request(int fd)
-    {
-      (void) make_request(tn_reply, fd, TN_REQUEST, TN_REPLY_PREFIX, TN_REPLY_SUFFIX);
 
-      // Recognize the error code.
-      if (tn_reply.starts_with(DCS "0"))
-        tn_reply = "???";
-    }
+    // Geometry of the terminals for which the kernel does not know it, determined with requests.  The key is
+    // that of the cache.
+    std::mutex geometry_lock;
+    std::map<std::string,std::tuple<unsigned,unsigned>> known_geometry;
 
-    void info_impl::make_q_request(int fd)
+
+    std::optional<std::tuple<unsigned,unsigned>> kernel_geometry(int fd)
     {
-      (void) make_request(q_reply, fd, Q_REQUEST, Q_REPLY_PREFIX, Q_REPLY_SUFFIX);
+      // Serial lines and some pseudo terminal bridges report 0x0.
+      winsize ws;
+      if (::ioctl(fd, TIOCGWINSZ, &ws) != 0 || ws.ws_col == 0 || ws.ws_row == 0)
+        return std::nullopt;
+      return std::make_tuple(unsigned(ws.ws_col), unsigned(ws.ws_row));
     }
 
-    void info_impl::make_osc702_request(int fd)
+
+    std::optional<std::tuple<unsigned,unsigned>> cached_geometry(int fd)
     {
-      (void) make_request(osc702_reply, fd, OSC702_REQUEST, OSC702_REPLY_PREFIX, OSC702_REPLY_SUFFIX);
+      struct stat st;
+      if (! info::stat_device(fd, st))
+        return std::nullopt;
+      std::lock_guard guard(geometry_lock);
+      auto it = known_geometry.find(get_cache_key(st));
+      return it == known_geometry.end() ? std::nullopt : std::make_optional(it->second);
     }
 
 
-    bool info_impl::is_st() const
+    void remember_geometry(int fd, std::tuple<unsigned,unsigned> size)
     {
-      if (implementation != implementations::unknown)
-        return implementation == implementations::st;
-
-      return da1_reply == "6" && da2_alarmed;
+      struct stat st;
+      if (! info::stat_device(fd, st))
+        return;
+      std::lock_guard guard(geometry_lock);
+      known_geometry[get_cache_key(st)] = size;
     }
 
 
-    bool info_impl::is_alacritty() const
+    // Remove the reports with the given final byte (CSI P1 ; P2 ... FINAL) from the input and return their parameters.
+    // If FIRST is given only reports with this first parameter are removed.
+    std::vector<std::vector<unsigned>> extract_reports(std::string& reply, char final, std::optional<unsigned> first = std::nullopt)
     {
-      if (implementation != implementations::unknown)
-        return implementation == implementations::alacritty;
+      std::vector<std::vector<unsigned>> res;
+
+      size_t pos = 0;
+      while ((pos = reply.find(CSI, pos)) != std::string::npos) {
+        std::vector<unsigned> params;
+        const char* p = reply.data() + pos + strlen(CSI);
+        const char* end = reply.data() + reply.size();
+        while (p < end) {
+          unsigned v = 0;
+          auto [next, ec] = std::from_chars(p, end, v);
+          if (ec != std::errc() || next == end)
+            break;
+          params.push_back(v);
+          p = next;
+          if (*p != ';')
+            break;
+          ++p;
+        }
 
-      if (da2_reply.size() < 5)
-        return false;
+        if (p == end || *p != final || params.empty() || (first && params[0] != *first)) {
+          pos += strlen(CSI);
+          continue;
+        }
+        res.emplace_back(std::move(params));
+        reply.erase(pos, p + 1 - (reply.data() + pos));
+      }
 
-      unsigned val;
-      auto [endp, ec] = std::from_chars(da2_reply.data() + 2, da2_reply.data() + da2_reply.size(), val, 10);
-      return ec == std::errc() && (da2_reply.data() + da2_reply.size() - endp) == 2 && da1_reply == "6" && da2_reply.starts_with("0;") && da2_reply.ends_with(";1");
+      return res;
     }
 
 
-    bool info_impl::is_vte() const
+    // Remove the replies to GEOMETRY_REQUEST from the input and return the geometry.  The text area report
+    // is preferred, the cursor position is only used if the terminal does not implement it.
+    std::optional<std::tuple<unsigned,unsigned>> extract_geometry(std::string& reply)
     {
-      if (implementation != implementations::unknown)
-        return implementation == implementations::vte;
+      std::optional<std::tuple<unsigned,unsigned>> res;
 
-      return da3_reply == "7E565445";
+      for (const auto& params : extract_reports(reply, CPR_REPLY_SUFFIX[0]))
+        if (params.size() == 2)
+          res = std::make_tuple(params[1], params[0]);
+      for (const auto& params : extract_reports(reply, WINOP_REPLY_SUFFIX[0]))
+        if (params.size() == 3 && params[0] == TEXT_AREA_REPLY && params[1] != 0 && params[2] != 0)
+          res = std::make_tuple(params[2], params[1]);
+
+      return res;
     }
 
 
-    // This function is not the inverse of is_vte.  It returns true only if given the limited information collected to that
-    // point it VTE can definitely be excluded.
-    bool info_impl::is_not_vte() const
+    // Remove the DECRQM replies from the input.  They are returned in the format used in info::raw, the
+    // parameters of the replies separated by commas, e.g., "?2048;2".
+    std::string extract_modes(std::string& reply)
     {
-      if (implementation != implementations::unknown)
-        return implementation != implementations::vte;
+      std::string res;
+
+      size_t pos = 0;
+      while ((pos = reply.find(CSI, pos)) != std::string::npos) {
+        auto start = pos + strlen(CSI);
+        auto end = reply.find_first_not_of("?0123456789;", start);
+        if (end == std::string::npos || reply.compare(end, strlen(DECRQM_REPLY_SUFFIX), DECRQM_REPLY_SUFFIX) != 0) {
+          pos = start;
+          continue;
+        }
+        if (! res.empty())
+          res += ',';
+        res.append(reply, start, end - start);
+        reply.erase(pos, end + strlen(DECRQM_REPLY_SUFFIX) - pos);
+      }
 
-      // VTE always (so far) sets the terminal ID to 65.
-      return ! da1_reply.starts_with("65;") || ! da2_reply.starts_with("65;") || feature_set.contains(features::capturecontour);
+      return res;
     }
 
 
-    bool info_impl::is_rxvt() const
+    // Remove the reply to KEYBOARD_REQUEST from the input and return the flags.
+    std::optional<std::string> extract_keyboard(std::string& reply)
     {
-      if (implementation != implementations::unknown)
-        return implementation == implementations::rxvt;
+      size_t pos = 0;
+      while ((pos = reply.find(KEYBOARD_REPLY_PREFIX, pos)) != std::string::npos) {
+        auto start = pos + strlen(KEYBOARD_REPLY_PREFIX);
+        auto end = reply.find_first_not_of("0123456789", start);
+        if (end != std::string::npos && end > start && reply.compare(end, strlen(KEYBOARD_REPLY_SUFFIX), KEYBOARD_REPLY_SUFFIX) == 0) {
+          auto res = reply.substr(start, end - start);
+          reply.erase(pos, end + strlen(KEYBOARD_REPLY_SUFFIX) - pos);
+          return res;
+        }
+        pos = start;
+      }
 
-      return da2_reply.starts_with("85;") || da2_reply.starts_with("82;");
+      return std::nullopt;
     }
 
 
-    bool info_impl::is_mrxvt() const
+    // Remove the replies to COLOR_REQUEST from the input.  The capabilities found and the SGR attributes are
+    // returned in the format of info::raw.  Either is std::nullopt if there is no reply.
+    std::tuple<std::optional<std::string>,std::optional<std::string>> extract_color(std::string& reply)
     {
-      if (implementation != implementations::unknown)
-        return implementation == implementations::mrxvt;
+      std::optional<std::string> tcap;
+      std::optional<std::string> sgr;
 
-      return ! implementation_version.empty() && (da2_reply.starts_with("85;") || da2_reply.starts_with("82;"));
+      size_t pos = 0;
+      while ((pos = reply.find(DCS, pos)) != std::string::npos) {
+        auto end = reply.find(ST, pos);
+        if (end == std::string::npos)
+          break;
+        std::string_view sv(reply.data() + pos, end - pos);
+
+        if (sv.starts_with(TCAP_REPLY_PREFIX) || sv.starts_with(TCAP_NOT_FOUND)) {
+          if (! tcap)
+            tcap.emplace();
+          // The prefixes for found and not found capabilities have the same length.
+          auto name = sv.substr(strlen(TCAP_REPLY_PREFIX));
+          name = name.substr(0, name.find('='));
+          if (sv.starts_with(TCAP_REPLY_PREFIX) && (name == TCAP_RGB || name == TCAP_TC)) {
+            if (! tcap->empty())
+              *tcap += ',';
+            *tcap += name == TCAP_RGB ? "RGB" : "Tc";
+          }
+        } else if (sv.starts_with(DECRQSS_REPLY_PREFIX))
+          sgr = sv.substr(strlen(DECRQSS_REPLY_PREFIX));
+        else if (sv.starts_with(DECRQSS_INVALID))
+          sgr.emplace();
+        else {
+          pos = end;
+          continue;
+        }
+        reply.erase(pos, end + strlen(ST) - pos);
+      }
+
+      return { tcap, sgr };
     }
 
 
-    bool info_impl::is_kitty() const
-    {
-      if (implementation != implementations::unknown)
-        return implementation == implementations::kitty;
+    // The modes queried along with DA1 and the features they indicate if the terminal knows them.
+    const std::tuple<mode,features> detected_modes[] {
+      { { 2048 }, features::inband_resize },
+      { { 2004 }, features::bracketed_paste },
+      { { 1004 }, features::focus_events },
+      { { 1006 }, features::sgr_mouse },
+      { { 1049 }, features::alternate_screen },
+      { { 2026 }, features::synchronized_output },
+    };
 
-      return tn_reply == "787465726d2d6b69747479";
+
+    // DECRQM requests for all the modes, in one string.
+    std::string mode_requests(std::span<const mode> modes)
+    {
+      std::string res;
+      for (auto m : modes)
+        res += std::format(CSI "{}{}" DECRQM_REQUEST_SUFFIX, m.dec_private ? "?" : "", m.number);
+      return res;
     }
 
 
-    bool info_impl::is_xterm() const
+    // Parse the DECRQM replies in the format returned by extract_modes.
+    std::map<mode,mode_states> parse_mode_replies(std::string_view sv)
     {
-      if (implementation != implementations::unknown)
-        return implementation == implementations::xterm;
+      std::map<mode,mode_states> res;
+
+      for (auto part : std::views::split(sv, ',')) {
+        std::string_view p(part.begin(), part.end());
+        mode m { 0, p.starts_with('?') };
+        if (m.dec_private)
+          p.remove_prefix(1);
+        unsigned state = 0;
+        auto [ptr, ec] = std::from_chars(p.data(), p.data() + p.size(), m.number);
+        if (ec != std::errc() || ptr == p.data() + p.size() || *ptr != ';')
+          continue;
+        ++ptr;
+        if (auto [end, ec2] = std::from_chars(ptr, p.data() + p.size(), state); ec2 != std::errc() || end != p.data() + p.size())
+          continue;
+        // Values beyond the defined ones are treated like modes which are not recognized.
+        res[m] = state <= std::to_underlying(mode_states::permanently_reset) ? mode_states(state) : mode_states::not_recognized;
+      }
 
-      return q_reply.starts_with("XTerm");
+      return res;
     }
 
 
-    bool info_impl::is_contour() const
+    // Whether the terminal implements the mode, even if it cannot be changed.
+    bool is_known_mode(mode_states state)
     {
-      if (implementation != implementations::unknown)
-        return implementation == implementations::contour;
+      return state == mode_states::set || state == mode_states::reset || state == mode_states::permanently_set;
+    }
 
-      return q_reply.starts_with("contour");
+
+    // Whether the input ends with a complete DA1 reply.  Other replies can end in the same character.
+    bool ends_with_da1(std::string_view reply)
+    {
+      auto pos = reply.rfind(DA1_REPLY_PREFIX);
+      return pos != std::string_view::npos && reply.ends_with(DA1_REPLY_SUFFIX)
+             && reply.find_first_not_of("0123456789;", pos + strlen(DA1_REPLY_PREFIX)) == reply.size() - strlen(DA1_REPLY_SUFFIX);
     }
 
 
-    bool info_impl::is_terminology() const
+    // Send the requests followed by DA1 and return what arrives until the DA1 reply is complete.  All terminals
+    // answer DA1, there is no need to wait for the timeout if some of the requests are not understood.  Large
+    // replies take time, the timeout applies to each piece.
+    std::string query(transport& tr, std::string_view request)
     {
-      if (implementation != implementations::unknown)
-        return implementation == implementations::terminology;
+      if (! request_delay.has_value())
+        request_delay = get_default_request_delay();
 
-      return q_reply.starts_with("terminology");
+      tr.enter_raw();
+
+      std::string reply;
+      if (tr.write(std::string(request) + DA1_REQUEST)) {
+        auto delay = *request_delay + transmission_time(tr.speed(), request.size() + strlen(DA1_REQUEST) + max_reply_size);
+        while (! ends_with_da1(reply)) {
+          if (tr.wait(delay) <= 0)
+            break;
+          char buf[256];
+          auto n = tr.read(buf, sizeof(buf));
+          if (n <= 0)
+            break;
+          reply.append(buf, n);
+        }
+      }
+
+      tr.leave_raw();
+
+      return reply;
     }
 
 
-    bool info_impl::is_konsole() const
+    // Whether the colors are queried in alloc.
+    std::optional<bool> use_palette_query;
+
+    bool get_use_palette_query()
     {
-      if (implementation != implementations::unknown)
-        return implementation == implementations::konsole;
+      if (use_palette_query.has_value())
+        return *use_palette_query;
 
-      return q_reply.starts_with("Konsole");
+      auto val = std::getenv("TERMDETECT_PALETTE");
+      return val != nullptr && val[0] == '1';
     }
 
 
-    bool info_impl::is_eterm() const
+    // Parse a color specification in the form rgb:R/G/B where each component has one to four hex digits.
+    std::optional<rgb> parse_color_spec(std::string_view sv)
     {
-      return implementation == implementations::eterm;
+      if (! sv.starts_with("rgb:"))
+        return std::nullopt;
+      sv.remove_prefix(4);
+
+      unsigned comp[3];
+      for (size_t i = 0; i < 3; ++i) {
+        auto len = std::min(sv.find('/'), sv.size());
+        if (len == 0 || len > 4 || (i < 2) != (len < sv.size()))
+          return std::nullopt;
+        auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + len, comp[i], 16);
+        if (ec != std::errc() || ptr != sv.data() + len)
+          return std::nullopt;
+        // Scale to eight bits.
+        unsigned max = (1u << (4 * len)) - 1;
+        comp[i] = (comp[i] * 255 + max / 2) / max;
+        sv.remove_prefix(std::min(len + 1, sv.size()));
+      }
+
+      return rgb { uint8_t(comp[0]), uint8_t(comp[1]), uint8_t(comp[2]) };
     }
 
 
-    bool info_impl::is_qt5() const
+    // Number of SIGWINCH signals received since the first geometry_tracker object was created.
+    std::atomic<unsigned> winch_count;
+    struct sigaction previous_winch;
+    std::once_flag winch_once;
+
+    void winch_handler(int sig, siginfo_t* si, void* ctx)
     {
-      if (implementation != implementations::unknown)
-        return implementation == implementations::qt5;
+      winch_count.fetch_add(1, std::memory_order_relaxed);
 
-      return da2_emulation == emulations::vt100 && emulation == emulations::vt100avo;
+      if ((previous_winch.sa_flags & SA_SIGINFO) != 0)
+        previous_winch.sa_sigaction(sig, si, ctx);
+      else if (previous_winch.sa_handler != SIG_DFL && previous_winch.sa_handler != SIG_IGN)
+        previous_winch.sa_handler(sig);
     }
 
-  } // anonymous namespace
+    void install_winch_handler()
+    {
+      std::call_once(winch_once, []{
+        struct sigaction sa { };
+        sa.sa_sigaction = winch_handler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        ::sigaction(SIGWINCH, &sa, &previous_winch);
+      });
+    }
 
 
-  info_impl::info_impl(bool close_fd)
-  : info()
-  {
-    if (! request_delay.has_value())
-      request_delay = get_default_request_delay();
+    // Whether the emulator is determined from the process tree.
+    std::optional<bool> use_process_walk;
 
-    tty_fd = ::open(_PATH_TTY, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
-    if (tty_fd != -1) [[likely]] {
-      // The DA1 and DA2 requests seem to be universally implemented.  Note that the order of the calls is required.
-      // Information about the terminal emulation from DA2 is more reliable.
-      da2_alarmed = make_da2_request(tty_fd);
-      make_da1_request(tty_fd);
-
-      // The order to make requests without stalling/timing out in the reads is complicated.
-      // - alacritty does not handle CSI > q, DCS + q T N, DA3, nor OSC702
-      // - VTE does not understand CSI > q but that is the ultimate informer for xterm.
-      // - alternatively DA3 can be used as a weak signal for xterm but DA3 does not work for kitty nor rxvt
-      // - kitty needs the CSI + q T N request but this also does not work for VTE
-      // - Eterm and Emacs Term do not handle *anything*
-      // We break the cycle by not issuing DA3 early and avoid if the CSI > q and DCS + q T N requests if
-      // the terminal could possibly be VTE based.  Once we can exclude rxvt and kitty we can issue DA3
-      // to be sure.
-      // +----------------+-----------+---------------+-----------+-----------+-----------+------------+
-      // | Name           |    DA1    |      DA2      |    DA3    |     Q     |    TN     |   OSC702   |
-      // +----------------+-----------+---------------+-----------+-----------+-----------+------------+
-      // |                |           |               |           |           |           |            |
-      // | Alacritty      | 6         | 0;VERS;1      | no resp   | no resp   | no resp   |            |
-      // | Contour        | a lot     | 65;VERS;0     | C0000000  | contour * | ""        |            |
-      // | EmacsTerm      | no resp   | no resp       | no resp   | no resp   | echo      |            |
-      // | ETerm          | no resp   | no resp       | no resp   | no resp   | no resp   |            |
-      // | Foot           | 62;4;22   | 1;VERS;0      | 464f4f54  | foot(*    | 666F6F74  |            |
-      // | Kitty          | 62;       | 1;4000;29     | no resp   | kitty(*   | 78746572* |            |
-      // | Konsole        | 62;1;4    | 1;VERS;0      | 7E4B4445  | Konsole*  | no esp    |            |
-      // | rxvt           | 1;2       | 85;VERS;0     | no resp   | no resp   | no resp   | rxvt*      |
-      // | mrxvt          | 1;2       | 82;V1.V2.V3;0 | no resp   | no resp   | no resp   |            |
-      // | QT5            | 1;2       | 0;VERS;0      | no resp   | no resp   | echo      |            |
-      // | ST             | 6         | no resp       | no resp   | no resp   | no resp   |            |
-      // | Terminology    | a lot     | 61;VERS;0     | 7E7E5459  | terminolo*| no resp   |            |
-      // | VTE            | 65;1;9    | 65;VERS;1     | 7E565445  | no resp   | no resp   |            |
-      // | XTerm          | a lot     | 41;VERS;0     | 00000000  | XTerm(*   | no resp   |            |
-      // |                |           |               |           |           |           |            |
-      // +----------------+-----------+---------------+-----------+-----------+-----------+------------+
-      //
-      // Other terminals use the same engines:
-      // VTE: gnome-console, mate-terminal, lxterminal, xfce4-terminal, roxterm, tilix
-      // QT5: deepin, qterminal
+    bool get_use_process_walk()
+    {
+      if (use_process_walk.has_value())
+        return *use_process_walk;
 
+      auto val = std::getenv("TERMDETECT_PROCESS_WALK");
+      return val != nullptr && val[0] == '1';
+    }
+
+
+    // Executables of the emulators.  Other emulators based on VTE and Qt5 are added as they are found.
+    const std::map<std::string_view,implementations> known_executables {
+      { "xterm", implementations::xterm },
+      { "gnome-terminal-server", implementations::vte },
+      { "kgx", implementations::vte },
+      { "mate-terminal", implementations::vte },
+      { "xfce4-terminal", implementations::vte },
+      { "lxterminal", implementations::vte },
+      { "roxterm", implementations::vte },
+      { "tilix", implementations::vte },
+      { "foot", implementations::foot },
+      { "terminology", implementations::terminology },
+      { "contour", implementations::contour },
+      { "urxvt", implementations::rxvt },
+      { "urxvtd", implementations::rxvt },
+      { "rxvt", implementations::rxvt },
+      { "mrxvt", implementations::mrxvt },
+      { "kitty", implementations::kitty },
+      { "alacritty", implementations::alacritty },
+      { "st", implementations::st },
+      { "konsole", implementations::konsole },
+      { "Eterm", implementations::eterm },
+      { "emacs", implementations::emacsterm },
+      { "qterminal", implementations::qt5 },
+      { "deepin-terminal", implementations::qt5 },
+    };
+
+    // Programs which sit between the emulator and the terminal the process uses.  Replies come from
+    // them, not from the emulator, or the emulator is on another machine.
+    const std::array process_boundaries {
+      "sshd", "sshd-session", "dropbear", "mosh-server", "telnetd", "login", "tmux", "tmux: server", "screen", "SCREEN",
+      "conmon", "containerd-shim", "containerd-shim-runc-v2", "docker-init", "tini", "dumb-init", "ptyproxy",
+    };
+
+
+    struct process_info {
+      std::string name { };
+      pid_t ppid = 0;
+      dev_t tty = 0;
+    };
+
+
+    // Read the parent, the controlling terminal, and the name of the executable of a process.
+    std::optional<process_info> read_process(pid_t pid)
+    {
+      char buf[1024];
+      int fd = ::open(std::format("/proc/{}/stat", pid).c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd == -1)
+        return std::nullopt;
+      auto n = ::read(fd, buf, sizeof(buf) - 1);
+      ::close(fd);
+      if (n <= 0)
+        return std::nullopt;
+
+      // The name is in parentheses and can contain anything, including parentheses.
+      std::string_view sv(buf, n);
+      auto open = sv.find('(');
+      auto close = sv.rfind(')');
+      if (open == std::string_view::npos || close == std::string_view::npos || close < open || close + 4 > sv.size())
+        return std::nullopt;
+
+      process_info res;
+      res.name = sv.substr(open + 1, close - open - 1);
+      sv.remove_prefix(close + 4);
+
+      // The fields after the state are ppid, pgrp, session, and tty_nr.
+      unsigned long fields[4];
+      for (auto& f : fields) {
+        auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), f);
+        if (ec != std::errc { })
+          return std::nullopt;
+        sv.remove_prefix(ptr - sv.data() + (ptr < sv.data() + sv.size() ? 1 : 0));
+      }
+      res.ppid = pid_t(fields[0]);
+      // The kernel encodes the device number differently.
+      res.tty = makedev((fields[3] >> 8) & 0xfff, (fields[3] & 0xff) | ((fields[3] >> 12) & 0xfff00));
+
+      // The name in stat is truncated.  Use the executable if it is accessible.
+      char exe[PATH_MAX];
+      auto len = ::readlink(std::format("/proc/{}/exe", pid).c_str(), exe, sizeof(exe));
+      if (len > 0) {
+        std::string_view path(exe, len);
+        if (path.ends_with(" (deleted)"))
+          path.remove_suffix(10);
+        res.name = path.substr(path.rfind('/') + 1);
+      }
+
+      return res;
+    }
+
+
+    // Find a process of the same user which has the master side of the pseudo terminal open.
+    std::optional<std::string> find_pty_master_holder(unsigned ptyindex)
+    {
+      auto dir = ::opendir("/proc");
+      if (dir == nullptr)
+        return std::nullopt;
+
+      std::optional<std::string> res;
+      auto uid = ::getuid();
+      while (dirent* d = ::readdir(dir)) {
+        if (! isdigit(d->d_name[0]))
+          continue;
+        struct stat st;
+        if (::fstatat(dirfd(dir), d->d_name, &st, 0) != 0 || st.st_uid != uid)
+          continue;
+
+        auto fddir = std::format("/proc/{}/fd", d->d_name);
+        auto fds = ::opendir(fddir.c_str());
+        if (fds == nullptr)
+          continue;
+        while (dirent* f = ::readdir(fds)) {
+          char target[64];
+          auto len = ::readlinkat(dirfd(fds), f->d_name, target, sizeof(target));
+          if (len <= 0 || (std::string_view(target, len) != "/dev/ptmx" && std::string_view(target, len) != "/dev/pts/ptmx"))
+            continue;
+
+          // The index of the pseudo terminal appears in the fdinfo file.
+          int infofd = ::open(std::format("/proc/{}/fdinfo/{}", d->d_name, f->d_name).c_str(), O_RDONLY | O_CLOEXEC);
+          if (infofd == -1)
+            continue;
+          char info[512];
+          auto n = ::read(infofd, info, sizeof(info));
+          ::close(infofd);
+          if (n > 0 && std::string_view(info, n).find(std::format("tty-index:\t{}\n", ptyindex)) != std::string_view::npos) {
+            if (auto p = read_process(atoi(d->d_name)); p)
+              res = p->name;
+            break;
+          }
+        }
+        ::closedir(fds);
+        if (res)
+          break;
+      }
+
+      ::closedir(dir);
+      return res;
+    }
+
+
+    std::optional<implementations> walk_processes(int fd)
+    {
+      struct stat st;
+      if (! info::stat_device(fd, st))
+        return std::nullopt;
+
+      // Walk up the ancestors as long as they use the same terminal.  The first one which does not is
+      // the emulator or something between the emulator and us.
+      auto self = read_process(::getpid());
+      if (! self || self->tty != st.st_rdev)
+        return std::nullopt;
+      for (unsigned depth = 0; depth < 64 && self->ppid > 1; ++depth) {
+        auto parent = read_process(self->ppid);
+        if (! parent)
+          break;
+        if (parent->tty != st.st_rdev) {
+          if (auto it = known_executables.find(parent->name); it != known_executables.end())
+            return it->second;
+          if (std::ranges::find(process_boundaries, parent->name) != process_boundaries.end())
+            return std::nullopt;
+          break;
+        }
+        self = std::move(parent);
+      }
+
+      // The emulator might have started the process indirectly.  Unix98 pseudo terminals have the major numbers 136
+      // to 143.
+      if (major(st.st_rdev) < 136 || major(st.st_rdev) > 143)
+        return std::nullopt;
+      auto holder = find_pty_master_holder((major(st.st_rdev) - 136) * 256 + minor(st.st_rdev));
+      if (holder)
+        if (auto it = known_executables.find(*holder); it != known_executables.end())
+          return it->second;
+
+      return std::nullopt;
+    }
+
+
+    // Whether the daemon is asked.
+    std::optional<bool> use_daemon;
+
+    bool get_use_daemon()
+    {
+      if (use_daemon.has_value())
+        return *use_daemon;
+
+      auto val = std::getenv("TERMDETECT_DAEMON");
+      return val != nullptr && val[0] == '1';
+    }
+
+    // Time to wait for the first answer of the daemon.  It runs locally and need not wait for anything to answer.
+    constexpr int daemon_timeout = 10;
+    // Time to wait for the result of a detection the daemon performs.  This covers all requests running into the timeout
+    // for remote sessions.
+    constexpr int daemon_pending_timeout = 5000;
+
+
+    int daemon_connect()
+    {
+      auto path = info::daemon_socket();
+      sockaddr_un sun { };
+      sun.sun_family = AF_UNIX;
+      if (path.empty() || path.size() >= sizeof(sun.sun_path))
+        return -1;
+      memcpy(sun.sun_path, path.data(), path.size());
+
+      int sock = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+      if (sock != -1 && ::connect(sock, reinterpret_cast<const sockaddr*>(&sun), sizeof(sun)) != 0) {
+        ::close(sock);
+        sock = -1;
+      }
+      return sock;
+    }
+
+
+    bool daemon_send(int sock, daemon_ops op, int fd, std::string_view payload)
+    {
+      daemon_header h { daemon_version, op, uint16_t(payload.size()) };
+      iovec iov[2] { { &h, sizeof(h) }, { const_cast<char*>(payload.data()), payload.size() } };
+      msghdr msg { };
+      msg.msg_iov = iov;
+      msg.msg_iovlen = 2;
+
+      alignas(cmsghdr) char cbuf[CMSG_SPACE(sizeof(int))];
+      if (fd != -1) {
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+      }
+
+      return ::sendmsg(sock, &msg, MSG_NOSIGNAL) == ssize_t(sizeof(h) + payload.size());
+    }
+
+
+    std::optional<replies> daemon_lookup(int fd, const char* term, const char* colorterm)
+    {
+      int sock = daemon_connect();
+      if (sock == -1)
+        return std::nullopt;
+
+      std::optional<replies> res;
+      if (daemon_send(sock, daemon_ops::lookup, fd, std::format("{}{}{}", term ?: "", '\0', colorterm ?: ""))) {
+        int timeout = daemon_timeout;
+        while (true) {
+          pollfd pfd { sock, POLLIN, 0 };
+          if (::poll(&pfd, 1, timeout) != 1)
+            break;
+          char buf[4096];
+          auto n = ::recv(sock, buf, sizeof(buf), 0);
+          daemon_header h;
+          if (n < ssize_t(sizeof(h)))
+            break;
+          memcpy(&h, buf, sizeof(h));
+          if (h.version != daemon_version || size_t(n) != sizeof(h) + h.len)
+            break;
+
+          if (h.op == daemon_ops::pending)
+            timeout = daemon_pending_timeout;
+          else {
+            if (h.op == daemon_ops::found)
+              res = replies::parse(std::string_view(buf + sizeof(h), h.len));
+            break;
+          }
+        }
+      }
+
+      ::close(sock);
+      return res;
+    }
+
+
+    // Name of the file to log unknown fingerprints in.
+    std::optional<std::string> unknown_log_file;
+
+    const char* get_unknown_log_file()
+    {
+      if (unknown_log_file.has_value())
+        return unknown_log_file->empty() ? nullptr : unknown_log_file->c_str();
+
+      auto fname = std::getenv("TERMDETECT_UNKNOWN_LOG");
+      return fname != nullptr && fname[0] != '\0' ? fname : nullptr;
+    }
+
+    // The log is not grown beyond this size.  Since it is also read to find duplicates this keeps
+    // the cost bounded.
+    constexpr size_t unknown_log_limit = 64 * 1024;
+
+    // Environment variables which help identifying the emulator.
+    const std::array unknown_log_env {
+      "TERM", "COLORTERM", "TERM_PROGRAM", "TERM_PROGRAM_VERSION", "VTE_VERSION", "TMUX", "STY", "SSH_TTY",
+    };
+
+    // Fingerprints already logged or found in the log by this process.
+    std::mutex unknown_log_lock;
+    std::set<uint64_t> unknown_logged;
+
+
+    // FNV-1a hash of the fingerprint.
+    uint64_t fingerprint_hash(std::string_view sv)
+    {
+      uint64_t h = 0xcbf29ce484222325ull;
+      for (auto c : sv) {
+        h ^= uint8_t(c);
+        h *= 0x100000001b3ull;
+      }
+      return h;
+    }
+
+
+    // Make control characters in replies visible and keep the log line-based.
+    void append_escaped(std::string& res, std::string_view sv)
+    {
+      for (auto c : sv)
+        if (c == '\\')
+          res += "\\\\";
+        else if (uint8_t(c) < ' ' || c == '\x7f')
+          std::format_to(std::back_inserter(res), "\\x{:02x}", uint8_t(c));
+        else
+          res += c;
+    }
+
+
+    // A transcript starts with a magic string, followed by records which consist of a type byte, the time since the
+    // previous record in microseconds, the length of the payload, and the payload.  Numbers are encoded in LEB128
+    // format.
+    constexpr std::string_view transcript_magic { "TDTRANS\1" };
+
+    enum struct transcript_records : char {
+      env = 'E',                // Payload NAME=VALUE or NAME, if the variable is not set.
+      write = 'W',              // Request bytes.
+      read = 'R',               // Reply bytes, one record for each read call.
+      timeout = 'T',            // No input arrived.
+      error = 'X',              // Waiting for input failed.
+      speed = 'S',              // Line speed in decimal, only for serial lines.
+    };
+
+
+    // Transport which records the exchange with the terminal performed through another transport.
+    struct record_transport final : transport {
+      record_transport(transport& inner_, const char* fname_) : inner(inner_), fname(fname_) { }
+      ~record_transport() override;
+
+      void enter_raw() override { inner.enter_raw(); }
+      void leave_raw() override { inner.leave_raw(); }
+      bool write(std::string_view request) override;
+      int wait(int timeout) override;
+      ssize_t read(char* buf, size_t len) override;
+      const char* getenv(const char* name) override;
+      unsigned speed() override;
+      std::chrono::steady_clock::time_point now() override { return inner.now(); }
+
+    private:
+      void add(transcript_records type, std::string_view payload);
+      void add_number(uint64_t n);
+
+      transport& inner;
+      std::string fname;
+      std::string data { transcript_magic };
+      std::chrono::steady_clock::time_point last = inner.now();
+      bool speed_recorded = false;
+    };
+
+
+    record_transport::~record_transport()
+    {
+      int fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+      if (fd != -1) {
+        (void) ::write(fd, data.data(), data.size());
+        ::close(fd);
+      }
+    }
+
+
+    void record_transport::add_number(uint64_t n)
+    {
+      while (n >= 0x80) {
+        data.push_back(char(0x80 | (n & 0x7f)));
+        n >>= 7;
+      }
+      data.push_back(char(n));
+    }
+
+
+    void record_transport::add(transcript_records type, std::string_view payload)
+    {
+      auto now = inner.now();
+      data.push_back(std::to_underlying(type));
+      add_number(std::chrono::duration_cast<std::chrono::microseconds>(now - last).count());
+      add_number(payload.size());
+      data.append(payload);
+      last = now;
+    }
+
+
+    bool record_transport::write(std::string_view request)
+    {
+      add(transcript_records::write, request);
+      return inner.write(request);
+    }
+
+
+    int record_transport::wait(int timeout)
+    {
+      auto n = inner.wait(timeout);
+      if (n == 0)
+        add(transcript_records::timeout, "");
+      else if (n < 0)
+        add(transcript_records::error, "");
+      return n;
+    }
+
+
+    ssize_t record_transport::read(char* buf, size_t len)
+    {
+      auto n = inner.read(buf, len);
+      if (n > 0)
+        add(transcript_records::read, std::string_view(buf, n));
+      return n;
+    }
+
+
+    const char* record_transport::getenv(const char* name)
+    {
+      auto res = inner.getenv(name);
+      add(transcript_records::env, res == nullptr ? std::string(name) : std::format("{}={}", name, res));
+      return res;
+    }
+
+
+    unsigned record_transport::speed()
+    {
+      auto res = inner.speed();
+      if (res != 0 && ! speed_recorded) {
+        add(transcript_records::speed, std::format("{}", res));
+        speed_recorded = true;
+      }
+      return res;
+    }
+
+
+    // Transport which plays back a recorded transcript.  The requests are matched against the recorded ones so
+    // that a changed request order still finds the recorded replies.  Requests which have not been recorded are
+    // treated as unanswered.  Unless the replay happens in real time the recorded delays advance a virtual clock.
+    struct replay_transport final : transport {
+      struct record {
+        transcript_records type;
+        std::chrono::microseconds delay;
+        std::string payload;
+      };
+
+      replay_transport(bool realtime_) : realtime(realtime_) { }
+
+      bool load(const char* fname);
+
+      bool write(std::string_view request) override;
+      int wait(int timeout) override;
+      ssize_t read(char* buf, size_t len) override;
+      const char* getenv(const char* name) override;
+      unsigned speed() override { return line_speed; }
+      std::chrono::steady_clock::time_point now() override { return realtime ? transport::now() : clock; }
+
+    private:
+      bool realtime;
+      unsigned line_speed = 0;
+      std::chrono::steady_clock::time_point clock { };
+      std::vector<record> records { };
+      std::map<std::string,std::string,std::less<>> env { };
+      // Index of the next record to replay.
+      size_t next = 0;
+    };
+
+
+    bool replay_transport::load(const char* fname)
+    {
+      int fd = ::open(fname, O_RDONLY | O_CLOEXEC);
+      if (fd == -1)
+        return false;
+      std::string data;
+      char buf[4096];
+      ssize_t n;
+      while ((n = ::read(fd, buf, sizeof(buf))) > 0)
+        data.append(buf, n);
+      ::close(fd);
+
+      std::string_view sv = data;
+      if (! sv.starts_with(transcript_magic))
+        return false;
+      sv.remove_prefix(transcript_magic.size());
+
+      auto get_number = [&sv](uint64_t& res) {
+        res = 0;
+        for (unsigned shift = 0; ! sv.empty() && shift < 64; shift += 7) {
+          auto b = uint8_t(sv.front());
+          sv.remove_prefix(1);
+          res |= uint64_t(b & 0x7f) << shift;
+          if ((b & 0x80) == 0)
+            return true;
+        }
+        return false;
+      };
+
+      while (! sv.empty()) {
+        auto type = transcript_records(sv.front());
+        sv.remove_prefix(1);
+        uint64_t delay;
+        uint64_t len;
+        if (! get_number(delay) || ! get_number(len) || len > sv.size())
+          return false;
+        std::string payload(sv.substr(0, len));
+        sv.remove_prefix(len);
+
+        if (type == transcript_records::env) {
+          auto eq = payload.find('=');
+          if (eq != std::string::npos)
+            env.emplace(payload.substr(0, eq), payload.substr(eq + 1));
+        } else if (type == transcript_records::speed)
+          std::from_chars(payload.data(), payload.data() + payload.size(), line_speed);
+        else
+          records.emplace_back(type, std::chrono::microseconds(delay), std::move(payload));
+      }
+
+      return true;
+    }
+
+
+    bool replay_transport::write(std::string_view request)
+    {
+      // Find the recorded request.  If it is not the next one, search forward.
+      for (auto i = next; i < records.size(); ++i)
+        if (records[i].type == transcript_records::write && records[i].payload == request) {
+          next = i + 1;
+          return true;
+        }
+
+      // Not recorded.  Only this request remains unanswered.  What is left of the replies to the previous request
+      // must not be taken as its reply, skip to the next recorded request.  The wait then times out and the
+      // replies to the later requests are still found.
+      while (next < records.size() && records[next].type != transcript_records::write)
+        ++next;
+      return true;
+    }
+
+
+    int replay_transport::wait(int timeout)
+    {
+      if (next == records.size() || records[next].type == transcript_records::write) {
+        if (realtime)
+          std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+        clock += std::chrono::milliseconds(timeout);
+        return 0;
+      }
+
+      auto delay = std::min(records[next].delay, std::chrono::microseconds(std::chrono::milliseconds(timeout)));
+      if (realtime)
+        std::this_thread::sleep_for(delay);
+      clock += delay;
+
+      switch (records[next].type) {
+      case transcript_records::read:
+        return 1;
+      case transcript_records::timeout:
+        ++next;
+        return 0;
+      default:
+        ++next;
+        return -1;
+      }
+    }
+
+
+    ssize_t replay_transport::read(char* buf, size_t len)
+    {
+      if (next == records.size() || records[next].type != transcript_records::read) {
+        errno = EAGAIN;
+        return -1;
+      }
+
+      auto& payload = records[next].payload;
+      auto n = std::min(len, payload.size());
+      memcpy(buf, payload.data(), n);
+      if (n == payload.size())
+        ++next;
+      else
+        payload.erase(0, n);
+      return n;
+    }
+
+
+    const char* replay_transport::getenv(const char* name)
+    {
+      auto it = env.find(std::string_view(name));
+      return it == env.end() ? nullptr : it->second.c_str();
+    }
+
+
+    // Transport which answers requests with assumed replies in virtual time.  Each answered request
+    // takes the given round trip time, unanswered requests the full request delay.  Nothing is sent
+    // to the terminal.
+    struct explain_transport final : transport {
+      explain_transport(const replies& assumed_, std::chrono::microseconds rtt_) : assumed(assumed_), rtt(rtt_) { }
+
+      bool write(std::string_view request) override;
+      int wait(int timeout) override;
+      ssize_t read(char* buf, size_t len) override;
+      const char* getenv(const char* name) override;
+      unsigned speed() override;
+      std::chrono::steady_clock::time_point now() override { return clock; }
+
+    private:
+      const replies& assumed;
+      std::chrono::microseconds rtt;
+      std::chrono::steady_clock::time_point clock { };
+      std::string pending { };
+    };
+
+
+    bool explain_transport::write(std::string_view request)
+    {
+      // The colors are requested after the classification.  Only the DA1 request sent with them is answered, the
+      // replies do not change the plan.
+      if (request.starts_with(FOREGROUND_REQUEST) && request.ends_with(DA1_REQUEST))
+        request.remove_prefix(request.size() - strlen(DA1_REQUEST));
+      // Mode requests are sent together with DA1.  Answer those the assumed replies contain.
+      while (request.starts_with(CSI) && request.find(DECRQM_REQUEST_SUFFIX) != std::string_view::npos) {
+        auto end = request.find(DECRQM_REQUEST_SUFFIX);
+        auto mode = request.substr(strlen(CSI), end - strlen(CSI));
+        if (mode.find_first_not_of("?0123456789") != std::string_view::npos)
+          break;
+        for (auto part : std::views::split(std::string_view(assumed.modes), ','))
+          if (std::string_view sv(part.begin(), part.end()); sv.starts_with(mode) && sv.size() > mode.size() && sv[mode.size()] == ';')
+            pending += std::format(CSI "{}" DECRQM_REPLY_SUFFIX, sv);
+        request.remove_prefix(end + strlen(DECRQM_REQUEST_SUFFIX));
+      }
+      if (request.starts_with(KEYBOARD_REQUEST)) {
+        if (assumed.keyboard != not_issued && assumed.keyboard != no_reply)
+          pending += std::format(KEYBOARD_REPLY_PREFIX "{}" KEYBOARD_REPLY_SUFFIX, assumed.keyboard);
+        request.remove_prefix(strlen(KEYBOARD_REQUEST));
+      }
+      if (request.starts_with(COLOR_REQUEST)) {
+        if (assumed.tcap != not_issued && assumed.tcap != no_reply) {
+          auto found = std::format(",{},", assumed.tcap);
+          for (auto [name, hex] : { std::make_tuple("RGB", TCAP_RGB), std::make_tuple("Tc", TCAP_TC) })
+            if (found.contains(std::format(",{},", name)))
+              pending += std::format(TCAP_REPLY_PREFIX "{}=" ST, hex);
+            else
+              pending += std::format(TCAP_NOT_FOUND "{}" ST, hex);
+        }
+        if (assumed.sgr != not_issued && assumed.sgr != no_reply)
+          pending += assumed.sgr.empty() ? std::string(DECRQSS_INVALID ST) : std::format(DECRQSS_REPLY_PREFIX "{}" ST, assumed.sgr);
+        request.remove_prefix(strlen(COLOR_REQUEST));
+      }
+
+      // Reconstruct the complete reply from the stripped-down form in the replies structure.
+      const std::tuple<const char*,const std::string&,const char*,const char*> known[] {
+        { DA1_REQUEST, assumed.da1, DA1_REPLY_PREFIX, DA1_REPLY_SUFFIX },
+        { DECID_REQUEST, assumed.da1, DA1_REPLY_PREFIX, DA1_REPLY_SUFFIX },
+        { DA2_REQUEST, assumed.da2, DA2_REPLY_PREFIX, DA2_REPLY_SUFFIX },
+        { DA3_REQUEST, assumed.da3, DA3_REPLY_PREFIX, DA3_REPLY_SUFFIX },
+        { Q_REQUEST, assumed.q, Q_REPLY_PREFIX, Q_REPLY_SUFFIX },
+        { TN_REQUEST, assumed.tn, TN_REPLY_PREFIX, TN_REPLY_SUFFIX },
+        { OSC702_REQUEST, assumed.osc702, OSC702_REPLY_PREFIX, OSC702_REPLY_SUFFIX },
+      };
+      for (const auto& [req, value, prefix, suffix] : known)
+        if (request == req) {
+          if (value == no_reply || value == not_issued)
+            ;
+          else if (&value == &assumed.tn && value == "???")
+            pending += DCS "0+r" ST;
+          else
+            pending += std::format("{}{}{}", prefix, value, suffix);
+          break;
+        }
+      return true;
+    }
+
+
+    int explain_transport::wait(int timeout)
+    {
+      if (pending.empty()) {
+        clock += std::chrono::milliseconds(timeout);
+        return 0;
+      }
+      clock += rtt;
+      return 1;
+    }
+
+
+    ssize_t explain_transport::read(char* buf, size_t len)
+    {
+      auto n = std::min(len, pending.size());
+      if (n == 0) {
+        errno = EAGAIN;
+        return -1;
+      }
+      memcpy(buf, pending.data(), n);
+      pending.erase(0, n);
+      return n;
+    }
+
+
+    unsigned explain_transport::speed()
+    {
+      unsigned res = 0;
+      std::from_chars(assumed.speed.data(), assumed.speed.data() + assumed.speed.size(), res);
+      return res;
+    }
+
+
+    const char* explain_transport::getenv(const char* name)
+    {
+      if (strcmp(name, "TERM") == 0 && ! assumed.term.empty())
+        return assumed.term.c_str();
+      return transport::getenv(name);
+    }
+
+
+    // Render a request readably.
+    std::string visible(std::string_view sv)
+    {
+      std::string res;
+      for (auto c : sv)
+        if (c == '\e')
+          res += "\\e";
+        else if (c == '\\')
+          res += "\\\\";
+        else
+          res += c;
+      return res;
+    }
+
+
+    // Issue the request to the terminal and wait for the reply.  Returns true if there is no reply.
+    bool info_impl::make_request(std::string& res, transport& tr, probes probe, const char* request, const char* reply_prefix, const char* reply_suffix)
+    {
+      bool wok = false;
+      bool rok = false;
+
+      tr.enter_raw();
+
+      auto& rec = probe_records.emplace_back(probe, request);
+      rec.sent = tr.now() - detection_start;
+      rec.outcome = probe_outcomes::error;
+
+      TRACEPOINT(probe__write, int(std::to_underlying(probe)), request);
+      if (tr.write(request)) [[likely]] {
+        wok = true;
+
+        // On serial lines the request and the reply take noticeable time to be transmitted.
+        auto delay = *request_delay + transmission_time(tr.speed(), strlen(request) + max_reply_size);
+        auto deadline = tr.now() + std::chrono::milliseconds(delay);
+        auto n = tr.wait(delay);
+        rok = n != 0;
+        if (rok) {
+          rec.first_byte = tr.now() - detection_start;
+
+          // The reply need not arrive in one piece.  Keep reading until the expected suffix is seen or the time is up.
+          std::string reply;
+          char buf[4096];
+          bool complete = false;
+          while (true) {
+            auto nread = tr.read(buf, sizeof(buf));
+            if (nread <= 0)
+              break;
+            reply.append(buf, nread);
+            // Flow control characters can be mixed in on serial lines if the driver does not handle them.
+            std::erase_if(reply, [](char c) { return c == '\x11' || c == '\x13'; });
+            // The replies batched with DA1 can end in the same character as the DA1 reply.
+            if (probe == probes::da1 ? ends_with_da1(reply) : reply.ends_with(reply_suffix)) {
+              complete = true;
+              break;
+            }
+
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - tr.now()).count();
+            if (left <= 0 || tr.wait(left) <= 0)
+              break;
+          }
+
+          rec.complete = tr.now() - detection_start;
+          rec.bytes = reply.size();
+          TRACEPOINT(reply__read, int(std::to_underlying(probe)), reply.size(), reply.c_str());
+          if (complete)
+            rec.outcome = probe_outcomes::answered;
+          else if (! reply.empty()) {
+            rec.outcome = probe_outcomes::timed_out;
+            TRACEPOINT(probe__timeout, int(std::to_underlying(probe)));
+          }
+
+          rok = ! reply.empty();
+          if (rok) [[likely]]
+            res = std::move(reply);
+        } else {
+          res = no_reply;
+          rec.complete = tr.now() - detection_start;
+          rec.outcome = probe_outcomes::timed_out;
+          TRACEPOINT(probe__timeout, int(std::to_underlying(probe)));
+        }
+      }
+
+      tr.leave_raw();
+
+      if (wok && rok) {
+        // The replies to the geometry and mode requests precede the DA1 reply.
+        if (probe == probes::da1 && want_geometry)
+          text_area = extract_geometry(res);
+        if (probe == probes::da1 && modes_reply != not_issued)
+          if (auto found = extract_modes(res); ! found.empty())
+            modes_reply = std::move(found);
+        if (probe == probes::da1 && keyboard_reply != not_issued)
+          if (auto found = extract_keyboard(res); found)
+            keyboard_reply = std::move(*found);
+        if (probe == probes::da1 && sgr_reply != not_issued) {
+          auto [tcap, sgr] = extract_color(res);
+          if (tcap)
+            tcap_reply = std::move(*tcap);
+          if (sgr)
+            sgr_reply = std::move(*sgr);
+        }
+
+        // Strip out the expected prefix and suffix.
+        if (res.size() > strlen(reply_prefix) + strlen(reply_suffix) && res.starts_with(reply_prefix) && res.ends_with(reply_suffix)) [[likely]]
+          res = res.substr(strlen(reply_prefix), res.size() - (strlen(reply_suffix)) - (strlen(reply_prefix)));
+      }
+
+      return ! rok;
+    }
+
+
+    void info_impl::make_da1_request(transport& tr)
+    {
+      // The reply to DECID is the same as that to DA1.  Use it where every byte counts.
+      std::string request = tr.speed() != 0 ? DECID_REQUEST : DA1_REQUEST;
+      // The modes, the keyboard protocol, and the colors are queried at the same time.  Terminals which do not
+      // implement the requests ignore them.  Serial terminals mostly predate all of them.  Emacs term and Eterm
+      // do not answer DA2 and none of the requests are safe for them.  QT5 (DA2 0;VERS;0) echoes them.
+      if (tr.speed() == 0 && ! da2_alarmed && ! (da2_reply.starts_with("0;") && da2_reply.ends_with(";0"))) {
+        std::vector<mode> queried;
+        for (const auto& [m, f] : detected_modes)
+          queried.push_back(m);
+        request.insert(0, mode_requests(queried) + KEYBOARD_REQUEST);
+        request.insert(request.size() - strlen(DA1_REQUEST), COLOR_REQUEST);
+        modes_reply = no_reply;
+        keyboard_reply = no_reply;
+        tcap_reply = no_reply;
+        sgr_reply = no_reply;
+      }
+      if (want_geometry)
+        request.insert(0, GEOMETRY_REQUEST);
+      (void) make_request(da1_reply, tr, probes::da1, request.c_str(), DA1_REPLY_PREFIX, DA1_REPLY_SUFFIX);
+
+      parse_da1();
+      parse_modes();
+      parse_keyboard();
+    }
+
+
+    // A color as six hex digits, a dash if it is not known.
+    std::string color_hex(const std::optional<rgb>& c)
+    {
+      return c ? std::format("{:02x}{:02x}{:02x}", c->r, c->g, c->b) : "-";
+    }
+
+
+    std::optional<rgb> parse_color_hex(std::string_view sv)
+    {
+      uint32_t val;
+      auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), val, 16);
+      if (sv.size() != 6 || ec != std::errc() || ptr != sv.data() + sv.size())
+        return std::nullopt;
+      return rgb { uint8_t(val >> 16), uint8_t(val >> 8), uint8_t(val) };
+    }
+
+
+    std::string colors_request()
+    {
+      std::string res = FOREGROUND_REQUEST BACKGROUND_REQUEST;
+      for (unsigned i = 0; i < 256; ++i)
+        res += std::format(PALETTE_REQUEST_FMT, i);
+      return res;
+    }
+
+
+    // The replies are too long to be kept in info::raw.  Instead the colors are stored as foreground, background,
+    // and the palette, separated by commas.  The palette has six hex digits for each of the 256 entries or is empty.
+    //
+    // The palette of every supported emulator can be changed, through its configuration or with OSC 4, so there is
+    // no emulator for which the exchange could be skipped because the palette is known.  The request is not made,
+    // though, where the queries are not implemented and when the colors are cached.
+    void info_impl::query_colors(transport& tr)
+    {
+      // 256 palette queries are too much for a serial line.  The others do not implement the queries.
+      if (! get_use_palette_query() || colors_reply != not_issued || tr.speed() != 0 || is_linuxconsole() || is_eterm() || is_qt5()
+          || implementation == implementations::emacsterm)
+        return;
+
+      auto reply = query(tr, colors_request());
+
+      auto colors = default_palette();
+      bool any = false;
+      size_t pos = 0;
+      while ((pos = reply.find(OSC, pos)) != std::string::npos) {
+        pos += strlen(OSC);
+        auto end = std::min(reply.find(ST, pos), reply.find(BEL, pos));
+        if (end == std::string::npos)
+          break;
+        std::string_view sv(reply.data() + pos, end - pos);
+
+        unsigned idx;
+        auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), idx);
+        if (ec != std::errc() || ptr == sv.data() + sv.size() || *ptr != ';')
+          continue;
+        sv.remove_prefix(ptr + 1 - sv.data());
+        if (idx == 4) {
+          auto [ptr2, ec2] = std::from_chars(sv.data(), sv.data() + sv.size(), idx);
+          if (ec2 != std::errc() || idx >= colors.size() || ptr2 == sv.data() + sv.size() || *ptr2 != ';')
+            continue;
+          sv.remove_prefix(ptr2 + 1 - sv.data());
+          if (auto c = parse_color_spec(sv); c) {
+            colors[idx] = *c;
+            any = true;
+          }
+        } else if (idx == 10)
+          foreground = parse_color_spec(sv);
+        else if (idx == 11)
+          background = parse_color_spec(sv);
+      }
+
+      if (any)
+        palette.assign(colors.begin(), colors.end());
+
+      if (! any && ! foreground && ! background)
+        colors_reply = no_reply;
+      else {
+        colors_reply = std::format("{},{},", color_hex(foreground), color_hex(background));
+        for (const auto& c : palette)
+          colors_reply += color_hex(c);
+      }
+      format_raw();
+    }
+
+
+    void info_impl::parse_colors()
+    {
+      if (colors_reply == not_issued || colors_reply == no_reply)
+        return;
+
+      std::string_view sv(colors_reply);
+      auto c1 = sv.find(',');
+      auto c2 = sv.find(',', c1 == std::string_view::npos ? c1 : c1 + 1);
+      if (c2 == std::string_view::npos)
+        return;
+      foreground = parse_color_hex(sv.substr(0, c1));
+      background = parse_color_hex(sv.substr(c1 + 1, c2 - c1 - 1));
+
+      sv.remove_prefix(c2 + 1);
+      if (sv.size() == 6 * 256) {
+        palette.resize(256);
+        for (size_t i = 0; i < palette.size(); ++i)
+          palette[i] = parse_color_hex(sv.substr(6 * i, 6)).value_or(rgb { });
+      }
+    }
+
+
+    void info_impl::parse_color()
+    {
+      bool direct = false;
+      bool indexed = false;
+
+      if (sgr_reply != not_issued && sgr_reply != no_reply && ! sgr_reply.empty()) {
+        // The readback is the most reliable.  Some terminals use semicolons as the separators.
+        auto sgr = sgr_reply;
+        std::ranges::replace(sgr, ';', ':');
+        direct = sgr.contains("48:2:" DIRECT_COLOR) || sgr.contains("48:2::" DIRECT_COLOR);
+        indexed = ! direct && sgr.contains("48:5:");
+      }
+      // A readback without the color (e.g., only 0m) tells nothing.  Use the other evidence then.
+      if (! direct && ! indexed) {
+        if (tcap_reply != not_issued && tcap_reply != no_reply && ! tcap_reply.empty())
+          direct = true;
+        else
+          direct = colorterm == "truecolor" || colorterm == "24bit";
+      }
+
+      if (direct) {
+        feature_set.insert(features::truecolor);
+        color_depth = 24;
+      } else if (indexed)
+        color_depth = 8;
+      else if (feature_set.contains(features::ansicolors))
+        color_depth = 4;
+    }
+
+
+    void info_impl::parse_da1()
+    {
+      std::string_view sv = da1_reply;
+
+      // Remove the terminal prefix from DA1 reply.  Some emulators (e.g., Terminology)
+      // are inconsistent in the announcement of the terminal type in the DA2 and DA1
+      // replies.  Give preference to the former.
+      for (const auto& e : known_emulations)
+        if (sv.starts_with(std::get<const char*>(e))) {
+          if (emulation == emulations::unknown || emulation == emulations::vt100)
+            emulation = std::get<emulations>(e);
+          sv.remove_prefix(strlen(std::get<const char*>(e)));
+          break;
+        } else if (sv.size() == strlen(std::get<const char*>(e)) - 1 && strncmp(sv.data(), std::get<const char*>(e), sv.size()) == 0) {
+          // Some terminals just announce the emulation and therefore do not have the trailing semicolon
+          // present in the known_emulation table.
+          if (emulation == emulations::unknown)
+            emulation = std::get<emulations>(e);
+          sv.remove_prefix(sv.size());
+          break;
+        }
+
+      while (! sv.empty()) {
+        unsigned code;
+        auto [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), code);
+        if (ec != std::errc{ } || ! (ptr == sv.data() + sv.size() || ptr[0] == ';'))
+          break;
+        if (ptr[0] != '\0')
+          ++ptr;
+        if (auto feature = known_features.find(code); feature != known_features.end())
+          feature_set.insert(feature->second);
+        else
+          unknown_features += std::string(sv.data(), ptr - sv.data());
+        sv.remove_prefix(ptr - sv.data());
+      }
+
+      if (unknown_features.ends_with(";"))
+        unknown_features.erase(unknown_features.size() - 1);
+    }
+
+
+    void info_impl::parse_modes()
+    {
+      if (modes_reply == not_issued || modes_reply == no_reply)
+        return;
+
+      modes = parse_mode_replies(modes_reply);
+      for (const auto& [m, f] : detected_modes)
+        if (auto it = modes.find(m); it != modes.end() && is_known_mode(it->second))
+          feature_set.insert(f);
+    }
+
+
+    void info_impl::parse_keyboard()
+    {
+      if (keyboard_reply == not_issued || keyboard_reply == no_reply)
+        return;
+
+      if (auto [ptr, ec] = std::from_chars(keyboard_reply.data(), keyboard_reply.data() + keyboard_reply.size(), keyboard_flags);
+          ec == std::errc() && ptr == keyboard_reply.data() + keyboard_reply.size())
+        feature_set.insert(features::kitty_keyboard);
+    }
+
+
+    bool info_impl::make_da2_request(transport& tr)
+    {
+      bool rfailed = make_request(da2_reply, tr, probes::da2, DA2_REQUEST, DA2_REPLY_PREFIX, DA2_REPLY_SUFFIX);
+
+      parse_da2();
+
+      return rfailed;
+    }
+
+
+    void info_impl::parse_da2()
+    {
+      std::string_view sv = da2_reply;
+
+      bool matched = false;
+      for (const auto& e : known_emulations)
+        if (sv.starts_with(std::get<const char*>(e))) {
+          da2_emulation = emulation = std::get<emulations>(e);
+          sv.remove_prefix(strlen(std::get<const char*>(e)));
+          matched = true;
+          break;
+        }
+
+      if (! matched && sv.starts_with("1;"))
+        // This is the non-descript answer of VT220 etc which refer to DA1 for the real answer.
+        // Only the rest of the information is important.
+        sv.remove_prefix(2);
+
+      // The DA2 reply consists of the version information.  Usually separated by semicolons.
+      auto skip = sv.find(';');
+      auto svend = sv.data() + (skip == std::string_view::npos ? sv.size() : skip);
+      auto [endp, ec] = std::from_chars(sv.data(), svend, vn);
+      if (ec == std::errc { }) {
+        if (endp < svend && *endp == '.') {
+          do {
+            unsigned vn2;
+            auto [endp2, ec2] = std::from_chars(endp + 1, svend, vn2);
+            endp = endp2;
+            ec = ec2;
+          } while (ec == std::errc { } && endp < svend && *endp == '.');
+          if (ec == std::errc { } && (endp == svend || *endp == ';'))
+            implementation_version = std::string(sv.data(), endp);
+
+          sv.remove_prefix(endp - sv.data());
+          if (sv == ";0")
+            return;
+        } else
+          sv.remove_prefix(endp - sv.data());
+
+        da2_reply_tail = sv;
+        if (sv[0] == ';') {
+          unsigned vn2;
+          auto [endp2, ec2] = std::from_chars(sv.data() + 1, sv.data() + sv.size(), vn2);
+
+          // Terminal emulators do not agree how to encode the version number.  Some encode all the data in the number
+          // after the first semicolon.  Others use the second semicolon as a decimal point.  Yet others use floating-point
+          // notation.  Try to guess.
+          if (ec2 == std::errc { } && vn < 10000 && vn2 != 0 && vn2 < 100) {
+            vn = vn * 100 + vn2;
+            sv.remove_prefix(endp2 - sv.data());
+            da2_reply_tail = sv;
+          }
+          // Many emulators add ";0" at the end.  Ignore it.
+          if (da2_reply_tail == ";0")
+            da2_reply_tail = "";
+        }
+      }
+    }
+
+
+    void info_impl::make_da3_request(transport& tr)
+    {
+      (void) make_request(da3_reply, tr, probes::da3, DA3_REQUEST, DA3_REPLY_PREFIX, DA3_REPLY_SUFFIX);
+    }
+
+    void info_impl::make_tn_request(transport& tr)
+    {
+      (void) make_request(tn_reply, tr, probes::tn, TN_REQUEST, TN_REPLY_PREFIX, TN_REPLY_SUFFIX);
+
+      // Recognize the error code.
+      if (tn_reply.starts_with(DCS "0"))
+        tn_reply = "???";
+    }
+
+    void info_impl::make_q_request(transport& tr)
+    {
+      (void) make_request(q_reply, tr, probes::q, Q_REQUEST, Q_REPLY_PREFIX, Q_REPLY_SUFFIX);
+    }
+
+    void info_impl::make_osc702_request(transport& tr)
+    {
+      (void) make_request(osc702_reply, tr, probes::osc702, OSC702_REQUEST, OSC702_REPLY_PREFIX, OSC702_REPLY_SUFFIX);
+    }
+
+
+    bool info_impl::is_st() const
+    {
+      if (implementation != implementations::unknown)
+        return implementation == implementations::st;
+
+      return da1_reply == "6" && da2_alarmed && line_speed == 0;
+    }
+
+
+    bool info_impl::is_alacritty() const
+    {
+      if (implementation != implementations::unknown)
+        return implementation == implementations::alacritty;
+
+      if (da2_reply.size() < 5)
+        return false;
+
+      unsigned val;
+      auto [endp, ec] = std::from_chars(da2_reply.data() + 2, da2_reply.data() + da2_reply.size(), val, 10);
+      return ec == std::errc() && (da2_reply.data() + da2_reply.size() - endp) == 2 && da1_reply == "6" && da2_reply.starts_with("0;") && da2_reply.ends_with(";1")
+             && line_speed == 0;
+    }
+
+
+    bool info_impl::is_vte() const
+    {
+      if (implementation != implementations::unknown)
+        return implementation == implementations::vte;
+
+      return da3_reply == "7E565445";
+    }
+
+
+    // This function is not the inverse of is_vte.  It returns true only if given the limited information collected to that
+    // point it VTE can definitely be excluded.
+    bool info_impl::is_not_vte() const
+    {
+      if (implementation != implementations::unknown)
+        return implementation != implementations::vte;
+
+      // VTE always (so far) sets the terminal ID to 65.
+      return ! da1_reply.starts_with("65;") || ! da2_reply.starts_with("65;") || feature_set.contains(features::capturecontour);
+    }
+
+
+    bool info_impl::is_rxvt() const
+    {
+      if (implementation != implementations::unknown)
+        return implementation == implementations::rxvt;
+
+      return da2_reply.starts_with("85;") || da2_reply.starts_with("82;");
+    }
+
+
+    bool info_impl::is_mrxvt() const
+    {
+      if (implementation != implementations::unknown)
+        return implementation == implementations::mrxvt;
+
+      return ! implementation_version.empty() && (da2_reply.starts_with("85;") || da2_reply.starts_with("82;"));
+    }
+
+
+    bool info_impl::is_kitty() const
+    {
+      if (implementation != implementations::unknown)
+        return implementation == implementations::kitty;
+
+      return tn_reply == "787465726d2d6b69747479";
+    }
+
+
+    bool info_impl::is_xterm() const
+    {
+      if (implementation != implementations::unknown)
+        return implementation == implementations::xterm;
+
+      return q_reply.starts_with("XTerm");
+    }
+
+
+    bool info_impl::is_contour() const
+    {
+      if (implementation != implementations::unknown)
+        return implementation == implementations::contour;
+
+      return q_reply.starts_with("contour");
+    }
+
+
+    bool info_impl::is_terminology() const
+    {
+      if (implementation != implementations::unknown)
+        return implementation == implementations::terminology;
+
+      return q_reply.starts_with("terminology");
+    }
+
+
+    bool info_impl::is_konsole() const
+    {
+      if (implementation != implementations::unknown)
+        return implementation == implementations::konsole;
+
+      return q_reply.starts_with("Konsole");
+    }
+
+
+    bool info_impl::is_eterm() const
+    {
+      return implementation == implementations::eterm;
+    }
+
+
+    bool info_impl::is_qt5() const
+    {
+      if (implementation != implementations::unknown)
+        return implementation == implementations::qt5;
+
+      return da2_emulation == emulations::vt100 && emulation == emulations::vt100avo;
+    }
+
+
+    bool info_impl::is_linuxconsole() const
+    {
+      return implementation == implementations::linuxconsole;
+    }
+
+
+    // The Linux console is recognized by the keyboard attached to it.  Serial lines and pseudo
+    // terminals do not have one.
+    bool is_linux_vt(int fd)
+    {
+      struct stat st;
+      char kbtype;
+      return info::stat_device(fd, st) && major(st.st_rdev) == 4 && minor(st.st_rdev) < 64
+             && ::ioctl(fd, KDGKBTYPE, &kbtype) == 0 && (kbtype == KB_101 || kbtype == KB_84);
+    }
+
+
+    void info_impl::identify_silent(const char* term)
+    {
       // We are desperate when checking for eterm and emacs term.  They do not handle any request and others than
       // Any request other than DA1 and DA2 must be avoided (eterm does not trip over DA3 but still).
       if (da1_reply == no_reply && da2_reply == no_reply) {
-        if (auto term = ::getenv("TERM"); term != nullptr && strncmp(term, "eterm", 5) == 0) {
+        decision("no reply to DA1 and DA2");
+        if (term != nullptr && strncmp(term, "eterm", 5) == 0) {
           implementation = implementations::emacsterm;
           // Assume the most basic.
           emulation = emulations::vt100;
@@ -548,211 +2126,960 @@ namespace terminal {
           // Assume the most basic.
           emulation = emulations::vt100;
         }
+      } else if (da1_reply == "6" && da2_alarmed && line_speed == 0 && term != nullptr && strcmp(term, "linux") == 0) {
+        // The Linux console answers like st.  When it is used through a file descriptor for the VT
+        // it is recognized without any request.
+        decision("Linux console");
+        implementation = implementations::linuxconsole;
+      }
+    }
+
+  } // anonymous namespace
+
+
+  info_impl::info_impl(bool close_fd)
+  : info()
+  {
+    tty_fd = ::open(_PATH_TTY, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (tty_fd != -1) [[likely]] {
+      fd_transport tr(tty_fd);
+
+      // The Linux console has a fixed set of capabilities and cannot be recognized from its replies
+      // without a timeout.
+      if (is_linux_vt(tty_fd)) {
+        implementation = implementations::linuxconsole;
+        if (utsname u; ::uname(&u) == 0)
+          implementation_version = std::string_view(u.release).substr(0, std::string_view(u.release).find_first_not_of("0123456789."));
+        for (auto p : { probes::da1, probes::da2, probes::da3, probes::q, probes::tn, probes::osc702 })
+          probe_records.emplace_back(p);
+        if (close_fd)
+          close();
+
+        classify();
+        account();
+        return;
+      }
+
+      // For local sessions the process tree might tell without any requests.
+      if (get_use_process_walk())
+        if (auto impl = walk_processes(tty_fd); impl) {
+          implementation = *impl;
+          for (auto p : { probes::da1, probes::da2, probes::da3, probes::q, probes::tn, probes::osc702 })
+            probe_records.emplace_back(p);
+          // Nothing is requested, not even the colors.
+          format_raw();
+          if (close_fd)
+            close();
+
+          account();
+          return;
+        }
+
+      // The daemon or the cache might know the replies already.
+      auto term = tr.getenv("TERM");
+      std::optional<replies> known;
+      if (get_use_daemon())
+        known = daemon_lookup(tty_fd, term, tr.getenv("COLORTERM"));
+
+      std::string cache_key;
+      struct stat st;
+      if (! known && get_use_cache() && stat_device(tty_fd, st)) {
+        cache_key = get_cache_key(st);
+        if (auto fname = get_cache_file(st); ! fname.empty())
+          known = cache_lookup(fname, cache_key);
+      }
+
+      if (known && known->term == (term ?: "")) {
+        colorterm = tr.getenv("COLORTERM") ?: "";
+        from_replies(*known);
+        classify();
+        // The colors are only requested if the cached replies do not contain them yet.
+        if (colors_reply == not_issued) {
+          query_colors(tr);
+          if (colors_reply != not_issued && ! cache_key.empty())
+            if (auto fname = get_cache_file(st, true); ! fname.empty())
+              cache_store(fname, cache_key, raw, term);
+        }
+        if (close_fd)
+          close();
+
+        counters.cache_hits.fetch_add(1, std::memory_order_relaxed);
+        account();
+        return;
+      }
+
+      // No extra round trip is needed if the size of the terminal is unknown.
+      want_geometry = ! kernel_geometry(tty_fd) && ! cached_geometry(tty_fd);
+
+      // The exchange for the colors is recorded as well.
+      std::optional<record_transport> rec;
+      if (auto fname = get_transcript_file(); fname != nullptr)
+        rec.emplace(tr, fname);
+      transport& used = rec ? static_cast<transport&>(*rec) : tr;
+      detect(used);
+
+      if (text_area)
+        remember_geometry(tty_fd, *text_area);
+
+      classify();
+      query_colors(used);
+      if (close_fd)
+        close();
+
+      account();
+      if (implementation == implementations::unknown)
+        log_unknown(tr);
+      if (! cache_key.empty())
+        if (auto fname = get_cache_file(st, true); ! fname.empty())
+          cache_store(fname, cache_key, raw, tr.getenv("TERM"));
+    }
+  }
+
+
+  info_impl::info_impl(transport& tr)
+  : info()
+  {
+    detect(tr);
+    classify();
+    query_colors(tr);
+    account();
+    if (implementation == implementations::unknown)
+      log_unknown(tr);
+  }
+
+
+  void info_impl::detect(transport& tr)
+  {
+    detection_start = tr.now();
+    TRACEPOINT(detect__start);
+
+    if (! request_delay.has_value())
+      request_delay = get_default_request_delay();
+
+    colorterm = tr.getenv("COLORTERM") ?: "";
+    line_speed = tr.speed();
+
+    // The DA1 and DA2 requests seem to be universally implemented.  Note that the order of the calls is required.
+    // Information about the terminal emulation from DA2 is more reliable.
+    da2_alarmed = make_da2_request(tr);
+    make_da1_request(tr);
+
+    // The order to make requests without stalling/timing out in the reads is complicated.
+    // - alacritty does not handle CSI > q, DCS + q T N, DA3, nor OSC702
+    // - VTE does not understand CSI > q but that is the ultimate informer for xterm.
+    // - alternatively DA3 can be used as a weak signal for xterm but DA3 does not work for kitty nor rxvt
+    // - kitty needs the CSI + q T N request but this also does not work for VTE
+    // - Eterm and Emacs Term do not handle *anything*
+    // We break the cycle by not issuing DA3 early and avoid if the CSI > q and DCS + q T N requests if
+    // the terminal could possibly be VTE based.  Once we can exclude rxvt and kitty we can issue DA3
+    // to be sure.
+    // +----------------+-----------+---------------+-----------+-----------+-----------+------------+
+    // | Name           |    DA1    |      DA2      |    DA3    |     Q     |    TN     |   OSC702   |
+    // +----------------+-----------+---------------+-----------+-----------+-----------+------------+
+    // |                |           |               |           |           |           |            |
+    // | Alacritty      | 6         | 0;VERS;1      | no resp   | no resp   | no resp   |            |
+    // | Contour        | a lot     | 65;VERS;0     | C0000000  | contour * | ""        |            |
+    // | EmacsTerm      | no resp   | no resp       | no resp   | no resp   | echo      |            |
+    // | ETerm          | no resp   | no resp       | no resp   | no resp   | no resp   |            |
+    // | Foot           | 62;4;22   | 1;VERS;0      | 464f4f54  | foot(*    | 666F6F74  |            |
+    // | Kitty          | 62;       | 1;4000;29     | no resp   | kitty(*   | 78746572* |            |
+    // | Konsole        | 62;1;4    | 1;VERS;0      | 7E4B4445  | Konsole*  | no esp    |            |
+    // | rxvt           | 1;2       | 85;VERS;0     | no resp   | no resp   | no resp   | rxvt*      |
+    // | mrxvt          | 1;2       | 82;V1.V2.V3;0 | no resp   | no resp   | no resp   |            |
+    // | QT5            | 1;2       | 0;VERS;0      | no resp   | no resp   | echo      |            |
+    // | ST             | 6         | no resp       | no resp   | no resp   | no resp   |            |
+    // | Terminology    | a lot     | 61;VERS;0     | 7E7E5459  | terminolo*| no resp   |            |
+    // | VTE            | 65;1;9    | 65;VERS;1     | 7E565445  | no resp   | no resp   |            |
+    // | XTerm          | a lot     | 41;VERS;0     | 00000000  | XTerm(*   | no resp   |            |
+    // |                |           |               |           |           |           |            |
+    // +----------------+-----------+---------------+-----------+-----------+-----------+------------+
+    //
+    // Other terminals use the same engines:
+    // VTE: gnome-console, mate-terminal, lxterminal, xfce4-terminal, roxterm, tilix
+    // QT5: deepin, qterminal
+
+    identify_silent(tr.getenv("TERM"));
+
+    // Detecting ST is, with the currently used requests, not possible without a delay.  It only
+    // responds to DA1 and its answer to that request (= "6") is not unique (same as Alacritty).
+    // Unless there is something else that can be done the best we can do is to limit the number
+    // of delays to one by determining the emulator type based on the DA2 request timeout.
+    //
+    // On serial lines there are hardware terminals and consoles of embedded systems.  They do not
+    // understand any of the other requests and each would only run into the timeout.
+    if (tr.speed() != 0)
+      decision("serial line");
+    else if (! is_st() && ! is_alacritty() && ! is_eterm() && ! is_qt5() && ! is_linuxconsole()) {
+      decision("more requests needed");
+      if (is_not_vte() && ! is_rxvt()) {
+        decision("neither VTE nor rxvt");
+        make_q_request(tr);
+
+        // Do not issue the TN request for rxvt and xterm.  We use the DA2 or Q reply for this.  It might not be conclusive but
+        // no counterexamples are known so far.
+        if (! is_rxvt() && ! is_xterm() && ! is_contour() && ! is_terminology() && ! is_konsole())
+          make_tn_request(tr);
+      }
+
+      if (! is_kitty() && ! is_rxvt()) {
+        decision("neither kitty nor rxvt");
+        make_da3_request(tr);
+
+        // Reconsider whether to issue the Q and TN requests.
+        if (is_not_vte() && ! is_vte() && ! is_xterm() && ! is_konsole()) {
+          make_q_request(tr);
+          if (! is_terminology())
+            make_tn_request(tr);
+        }
+      }
+
+      // Do not issue the DA3 and OSC702 requests for the kitty terminal emulator, it does not handle them so far.
+      // We also do not do this for mrxvt, it does not handle the DA3 request nor does it provide any answer
+      // to OSC702, just an empty string.
+      if (! is_kitty() && ! is_mrxvt()) {
+        decision("neither kitty nor mrxvt");
+        // Do not issue the DA3 request for rxvt.
+        if (! is_rxvt())
+          make_da3_request(tr);
+
+        if (da3_reply == not_issued) {
+          make_osc702_request(tr);
+
+          // The code below assumes that we can identify rxvt via the OSC702 reply.
+          assert(! is_rxvt() || osc702_reply.starts_with("rxvt"));
+        }
+      }
+    } else
+      decision("identified by DA1 and DA2");
+
+    for (auto p : { probes::da1, probes::da2, probes::da3, probes::q, probes::tn, probes::osc702 })
+      if (std::ranges::find(probe_records, p, &probe_record::probe) == probe_records.end())
+        probe_records.emplace_back(p);
+
+    detection_time = tr.now() - detection_start;
+    TRACEPOINT(detect__end, int64_t(detection_time.count()), probe_records.size());
+  }
+
+
+  info_impl::info_impl(const replies& r)
+  : info()
+  {
+    from_replies(r);
+    classify();
+  }
+
+
+  void info_impl::from_replies(const replies& r)
+  {
+    tn_reply = r.tn;
+    da1_reply = r.da1;
+    da2_reply = r.da2;
+    da3_reply = r.da3;
+    osc702_reply = r.osc702;
+    q_reply = r.q;
+    modes_reply = r.modes;
+    keyboard_reply = r.keyboard;
+    tcap_reply = r.tcap;
+    sgr_reply = r.sgr;
+    colors_reply = r.colors;
+    line_speed = 0;
+    std::from_chars(r.speed.data(), r.speed.data() + r.speed.size(), line_speed);
+
+    // Same order as when the requests are made.
+    da2_alarmed = da2_reply == no_reply || da2_reply == not_issued;
+    parse_da2();
+    parse_da1();
+    parse_modes();
+    parse_keyboard();
+    parse_colors();
+
+    identify_silent(r.term.empty() ? nullptr : r.term.c_str());
+  }
+
+
+  void info_impl::account() const
+  {
+    auto idx = std::min(size_t(std::to_underlying(implementation)), max_implementations - 1);
+    auto nrequests = std::ranges::count_if(probe_records, [](const auto& r) { return r.outcome != probe_outcomes::skipped; });
+    auto ntimeouts = std::ranges::count(probe_records, probe_outcomes::timed_out, &probe_record::outcome);
+    counters.detections[idx].fetch_add(1, std::memory_order_relaxed);
+    counters.requests[idx].fetch_add(nrequests, std::memory_order_relaxed);
+    counters.timeouts[idx].fetch_add(ntimeouts, std::memory_order_relaxed);
+
+    // The buckets are upper bounds, round up.
+    auto ms = std::chrono::ceil<std::chrono::milliseconds>(detection_time).count();
+    auto bucket = std::ranges::lower_bound(latency_buckets, ms, std::less<>{}, [](unsigned b) { return (long long)(b); }) - latency_buckets.begin();
+    counters.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+    counters.latency_sum_ns.fetch_add(detection_time.count(), std::memory_order_relaxed);
+
+    static std::once_flag registered;
+    std::call_once(registered, []{
+      if (auto fname = std::getenv("TERMDETECT_METRICS"); fname != nullptr && fname[0] != '\0')
+        std::atexit(write_metrics_file);
+    });
+  }
+
+
+  void info_impl::log_unknown(transport& tr) const
+  {
+    auto fname = get_unknown_log_file();
+    if (fname == nullptr)
+      return;
+
+    // The timing is not part of the fingerprint, only the replies and the terminal type.
+    auto term = tr.getenv("TERM");
+    auto hash = fingerprint_hash(std::format("{}, TERM={}", raw, term ?: ""));
+
+    std::lock_guard guard(unknown_log_lock);
+    if (! unknown_logged.insert(hash).second)
+      return;
+
+    int fd = ::open(fname, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (fd == -1)
+      return;
+
+    // Each line starts with the hash.  Look for it in what other processes logged.
+    std::string hashstr = std::format("{:016x} ", hash);
+    std::string old;
+    char buf[4096];
+    ssize_t n;
+    while (old.size() < unknown_log_limit && (n = ::pread(fd, buf, sizeof(buf), old.size())) > 0)
+      old.append(buf, n);
+    if (old.size() < unknown_log_limit && ! old.starts_with(hashstr) && old.find("\n" + hashstr) == std::string::npos) {
+      auto line = hashstr;
+      std::format_to(std::back_inserter(line), "time={}us", std::chrono::duration_cast<std::chrono::microseconds>(detection_time).count());
+      for (const auto& r : probe_records)
+        if (r.outcome != probe_outcomes::skipped) {
+          auto outcome = outcome_name(r.outcome);
+          std::ranges::replace(outcome, ' ', '-');
+          std::format_to(std::back_inserter(line), " {}={}us/{}", probe_name(r.probe),
+                         std::chrono::duration_cast<std::chrono::microseconds>(r.complete - r.sent).count(), outcome);
+        }
+      for (auto name : unknown_log_env)
+        if (auto val = tr.getenv(name); val != nullptr) {
+          std::format_to(std::back_inserter(line), " {}=", name);
+          append_escaped(line, val);
+        }
+      line += " raw=";
+      append_escaped(line, raw);
+      line += '\n';
+
+      // A single write so that lines from concurrent processes are not mixed.
+      if (old.size() + line.size() <= unknown_log_limit)
+        (void) ::write(fd, line.data(), line.size());
+    }
+
+    ::close(fd);
+  }
+
+
+  void info_impl::decision(const char* what)
+  {
+    TRACEPOINT(decision, what);
+    if (record_decisions) [[unlikely]]
+      decisions.emplace_back(probe_records.size(), what);
+  }
+
+
+  void info_impl::format_raw()
+  {
+    raw = std::format("TN={}, DA1={}, DA2={}, DA3={}, OSC702={}, Q={}", tn_reply, da1_reply, da2_reply, da3_reply, osc702_reply, q_reply);
+    // Older results do not have the field, keep them the same.
+    if (modes_reply != not_issued)
+      raw += std::format(", MODES={}", modes_reply);
+    if (keyboard_reply != not_issued)
+      raw += std::format(", KEYBOARD={}", keyboard_reply);
+    if (sgr_reply != not_issued)
+      raw += std::format(", TCAP={}, SGR={}", tcap_reply, sgr_reply);
+    if (line_speed != 0)
+      raw += std::format(", SPEED={}", line_speed);
+    if (colors_reply != not_issued)
+      raw += std::format(", COLORS={}", colors_reply);
+  }
+
+
+  void info_impl::classify()
+  {
+    format_raw();
+
+    // We are ready to determine the implementation.
+    if (is_st())
+      implementation = implementations::st;
+    else if (da3_reply == "7E565445")
+      implementation = implementations::vte;
+    else if (da3_reply == "464f4f54")
+      implementation = implementations::foot;
+    else if (is_terminology())
+      implementation = implementations::terminology;
+    else if (is_contour())
+      implementation = implementations::contour;
+    else if (is_xterm())
+      implementation = implementations::xterm;
+    else if (is_mrxvt())
+      implementation = implementations::mrxvt;
+    else if (osc702_reply.starts_with("rxvt"))
+      implementation = implementations::rxvt;
+    else if (is_kitty())
+      implementation = implementations::kitty;
+    else if (is_alacritty())
+      implementation = implementations::alacritty;
+    else if (is_konsole())
+      implementation = implementations::konsole;
+    else if (is_qt5())
+      implementation = implementations::qt5;
+
+    TRACEPOINT(classify, int(std::to_underlying(implementation)), raw.c_str());
+
+    // Determine the implementation version.
+    if (implementation_version.empty()) {
+      if (is_terminology()) {
+        // Terminology does not fill DA2 replies with appropriate version information.  Use the CSI > q reply.
+        assert(! q_reply.empty());
+        implementation_version = q_reply.substr(12);
+      } else if (is_konsole()) {
+        // Konsole does not fill DA2 replies with appropriate version information.  Use the CSI > q reply.
+        assert(! q_reply.empty());
+        implementation_version = q_reply.substr(8);
+      } else if (is_kitty() && q_reply.starts_with("kitty(") && q_reply.ends_with(")") && q_reply.size() > 7)
+        implementation_version = q_reply.substr(6, q_reply.size() - 7);
+      else {
+        if (is_rxvt())
+          // rxvt encodes the version number as Mm (major/minor) in two digits.
+          vn = (vn / 10) * 10000 + (vn % 10) * 100;
+        else if (is_kitty() && vn > 400000)
+          // For some reason kitty adds 4000 to the first number.
+          vn = (vn - 400000) * 100;
+        else if (is_xterm())
+          // XTerm version numbers are > 100 and there is not even a minor version number.
+          vn *= 10000;
+        else if (is_vte())
+          // Ignore the last number after all.
+          vn /= 100;
+
+        // Not all implementations provide a patch number.
+        if (vn % 10000 == 0)
+          implementation_version = std::format("{}", vn / 10000);
+        else if (vn % 100 == 0)
+          implementation_version = std::format("{}.{}", vn / 10000, (vn / 100) % 100);
+        else
+          implementation_version = std::format("{}.{}.{}", vn / 10000, (vn / 100) % 100, vn % 100);
+      }
+    }
+
+    if (is_alacritty() && emulation == emulations::vt100) {
+      std::string da1_extended = da1_reply + ";";
+      for (const auto& e : known_emulations)
+        if (da1_extended.starts_with(std::get<const char*>(e))) {
+          emulation = std::get<emulations>(e);
+          break;
+        }
+    }
+
+    if (is_linuxconsole()) {
+      emulation = emulations::vt102;
+      feature_set.insert(features::ansicolors);
+    }
+
+    // Add features which are not discovered automatically.
+    if (is_kitty())
+      // OSC777 supported.
+      feature_set.insert(features::desktopnotification);
+
+    // Unless demonstrated otherwise, assume that the terminal has DECSTBM support.
+    feature_set.insert(features::decstbm);
+
+    // After the features from DA1 are known.
+    parse_color();
+  }
+
+
+  const std::shared_ptr<info> info::alloc(bool close_fd)
+  {
+    return std::make_shared<info_impl>(close_fd);
+  }
+
+
+  const std::shared_ptr<info> info::alloc(transport& tr)
+  {
+    return std::make_shared<info_impl>(tr);
+  }
+
+
+  const std::shared_ptr<info> info::replay(const char* fname, bool realtime)
+  {
+    replay_transport tr(realtime);
+    if (! tr.load(fname))
+      return nullptr;
+    return std::make_shared<info_impl>(tr);
+  }
+
+
+  const std::shared_ptr<info> info::classify(const replies& r)
+  {
+    return std::make_shared<info_impl>(r);
+  }
+
+
+  std::string info::explain(const replies& assumed, std::chrono::microseconds rtt)
+  {
+    explain_transport tr(assumed, rtt);
+    info_impl ti;
+    ti.record_decisions = true;
+    ti.detect(tr);
+    ti.classify();
+
+    auto ms = [](std::chrono::nanoseconds ns) { return std::chrono::duration<double,std::milli>(ns).count(); };
+
+    auto term = tr.getenv("TERM");
+    std::string res = std::format("TERM={}, request delay {}ms, round trip {}ms\n", term ?: "", *request_delay, ms(rtt));
+    // In the worst case every request runs into the timeout, which on serial lines includes the transmission.
+    auto worst = [speed = tr.speed()](size_t request_size) { return *request_delay + transmission_time(speed, request_size + max_reply_size); };
+
+    auto next_decision = ti.decisions.begin();
+    unsigned nissued = 0;
+    long worst_case = 0;
+    for (size_t i = 0; i < ti.probe_records.size(); ++i) {
+      for (; next_decision != ti.decisions.end() && std::get<size_t>(*next_decision) == i; ++next_decision)
+        std::format_to(std::back_inserter(res), "  decision: {}\n", std::get<const char*>(*next_decision));
+
+      const auto& r = ti.probe_records[i];
+      if (r.outcome == probe_outcomes::skipped)
+        continue;
+      ++nissued;
+      worst_case += worst(r.request.size());
+      std::format_to(std::back_inserter(res), "{:>9.1f}ms  {:<6} {:<9}  {}\n", ms(r.sent), probe_name(r.probe), outcome_name(r.outcome), visible(r.request));
+    }
+    for (; next_decision != ti.decisions.end(); ++next_decision)
+      std::format_to(std::back_inserter(res), "  decision: {}\n", std::get<const char*>(*next_decision));
+
+    // The colors take one more round trip if they are requested.  The request is too long to be shown.
+    auto expected = ti.detection_time;
+    auto colors_start = tr.now();
+    ti.query_colors(tr);
+    if (ti.colors_reply != not_issued) {
+      auto request = colors_request() + DA1_REQUEST;
+      ++nissued;
+      worst_case += worst(request.size());
+      auto took = tr.now() - colors_start;
+      expected += took;
+      std::format_to(std::back_inserter(res), "{:>9.1f}ms  {:<6} {:<9}  {}... ({} bytes)\n", ms(ti.detection_time), "colors",
+                     took < std::chrono::milliseconds(*request_delay) ? "answered" : "timed out", visible(FOREGROUND_REQUEST BACKGROUND_REQUEST), request.size());
+    }
+
+    std::format_to(std::back_inserter(res), "result: {} {}\n{} requests, expected {:.1f}ms, worst case {}ms\n", ti.implementation_name(), ti.implementation_version,
+                   nissued, ms(expected), worst_case);
+
+    return res;
+  }
+
+
+  std::optional<replies> replies::parse(std::string_view raw)
+  {
+    replies res;
+
+    while (! raw.empty()) {
+      auto eq = raw.find('=');
+      if (eq == std::string_view::npos)
+        return std::nullopt;
+      auto key = raw.substr(0, eq);
+      raw.remove_prefix(eq + 1);
+
+      // The value extends to the next ", KEY=" separator.  The replies themselves might contain a comma.
+      auto end = raw.find(", ");
+      while (end != std::string_view::npos) {
+        auto next = raw.substr(end + 2);
+        auto keylen = next.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+        if (keylen != 0 && keylen != std::string_view::npos && next[keylen] == '=')
+          break;
+        end = raw.find(", ", end + 2);
+      }
+      auto value = raw.substr(0, end);
+      raw.remove_prefix(end == std::string_view::npos ? raw.size() : end + 2);
+
+      // Unknown fields are ignored, they might come from a newer version.
+      for (const auto& f : known_reply_fields)
+        if (key == std::get<const char*>(f)) {
+          res.*std::get<std::string replies::*>(f) = value;
+          break;
+        }
+    }
+
+    return res;
+  }
+
+
+  void info::set_request_delay(int ms)
+  {
+    request_delay = ms;
+  }
+
+
+  void info::set_cache(bool enable)
+  {
+    use_cache = enable;
+  }
+
+
+  bool info::stat_device(int fd, struct stat& st)
+  {
+    if (::fstat(fd, &st) != 0 || ! S_ISCHR(st.st_mode))
+      return false;
+    if (st.st_rdev != makedev(5, 0) && st.st_rdev != makedev(5, 1))
+      return true;
+
+    // This is /dev/tty which stands for the controlling terminal or /dev/console.  Determine the actual device.  The
+    // kernel encodes the device number differently.
+    unsigned int dev;
+    if (::ioctl(fd, TIOCGDEV, &dev) != 0)
+      return false;
+    auto rdev = makedev((dev >> 8) & 0xfff, (dev & 0xff) | ((dev >> 12) & 0xfff00));
+
+    std::string path;
+    if (major(rdev) >= 136 && major(rdev) <= 143)
+      // Unix98 pseudo terminal.
+      path = std::format("/dev/pts/{}", (major(rdev) - 136) * 256 + minor(rdev));
+    else
+      // The standard descriptors usually refer to the device directly.
+      for (int i = 0; i < 3 && path.empty(); ++i) {
+        char buf[PATH_MAX];
+        struct stat st2;
+        if (::ttyname_r(i, buf, sizeof(buf)) == 0 && ::stat(buf, &st2) == 0 && st2.st_rdev == rdev)
+          path = buf;
       }
 
-      // Detecting ST is, with the currently used requests, not possible without a delay.  It only
-      // responds to DA1 and its answer to that request (= "6") is not unique (same as Alacritty).
-      // Unless there is something else that can be done the best we can do is to limit the number
-      // of delays to one by determining the emulator type based on the DA2 request timeout.
-      if (! is_st() && ! is_alacritty() && ! is_eterm() && ! is_qt5()) {
-        if (is_not_vte() && ! is_rxvt()) {
-          make_q_request(tty_fd);
+    if (path.empty() || ::stat(path.c_str(), &st) != 0 || st.st_rdev != rdev) {
+      // Only the device number is known.
+      st.st_rdev = rdev;
+      st.st_ctim = timespec { };
+    }
+    return true;
+  }
 
-          // Do not issue the TN request for rxvt and xterm.  We use the DA2 or Q reply for this.  It might not be conclusive but
-          // no counterexamples are known so far.
-          if (! is_rxvt() && ! is_xterm() && ! is_contour() && ! is_terminology() && ! is_konsole())
-            make_tn_request(tty_fd);
-        }
 
-        if (! is_kitty() && ! is_rxvt()) {
-          make_da3_request(tty_fd);
+  std::optional<implementations> info::identify_by_process(int fd)
+  {
+    bool opened = false;
+    if (fd == -1) {
+      fd = ::open(_PATH_TTY, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+      if (fd == -1)
+        return std::nullopt;
+      opened = true;
+    }
+
+    auto res = walk_processes(fd);
 
-          // Reconsider whether to issue the Q and TN requests.
-          if (is_not_vte() && ! is_vte() && ! is_xterm() && ! is_konsole()) {
-            make_q_request(tty_fd);
-            if (! is_terminology())
-              make_tn_request(tty_fd);
-          }
-        }
+    if (opened)
+      ::close(fd);
+    return res;
+  }
+
+
+  void info::set_palette_query(bool enable)
+  {
+    use_palette_query = enable;
+  }
+
+
+  std::array<rgb,256> info::default_palette()
+  {
+    std::array<rgb,256> res {{
+      { 0x00, 0x00, 0x00 }, { 0xcd, 0x00, 0x00 }, { 0x00, 0xcd, 0x00 }, { 0xcd, 0xcd, 0x00 },
+      { 0x00, 0x00, 0xee }, { 0xcd, 0x00, 0xcd }, { 0x00, 0xcd, 0xcd }, { 0xe5, 0xe5, 0xe5 },
+      { 0x7f, 0x7f, 0x7f }, { 0xff, 0x00, 0x00 }, { 0x00, 0xff, 0x00 }, { 0xff, 0xff, 0x00 },
+      { 0x5c, 0x5c, 0xff }, { 0xff, 0x00, 0xff }, { 0x00, 0xff, 0xff }, { 0xff, 0xff, 0xff },
+    }};
+
+    const uint8_t levels[] { 0, 95, 135, 175, 215, 255 };
+    for (size_t i = 0; i < 216; ++i)
+      res[16 + i] = rgb { levels[i / 36], levels[i / 6 % 6], levels[i % 6] };
+    for (size_t i = 0; i < 24; ++i)
+      res[232 + i] = rgb { uint8_t(8 + 10 * i), uint8_t(8 + 10 * i), uint8_t(8 + 10 * i) };
+
+    return res;
+  }
+
+
+  void info::set_process_walk(bool enable)
+  {
+    use_process_walk = enable;
+  }
+
+
+  void info::set_daemon(bool enable)
+  {
+    use_daemon = enable;
+  }
+
+
+  std::string info::daemon_socket(bool create)
+  {
+    auto dir = get_runtime_dir(create);
+    return dir.empty() ? dir : dir + "/socket";
+  }
+
+
+  void info::invalidate(int fd)
+  {
+    bool opened = false;
+    if (fd == -1) {
+      fd = ::open(_PATH_TTY, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+      if (fd == -1)
+        return;
+      opened = true;
+    }
+
+    struct stat st;
+    if (stat_device(fd, st))
+      if (auto fname = get_cache_file(st); ! fname.empty())
+        ::unlink(fname.c_str());
 
-        // Do not issue the DA3 and OSC702 requests for the kitty terminal emulator, it does not handle them so far.
-        // We also do not do this for mrxvt, it does not handle the DA3 request nor does it provide any answer
-        // to OSC702, just an empty string.
-        if (! is_kitty() && ! is_mrxvt()) {
-          // Do not issue the DA3 request for rxvt.
-          if (! is_rxvt())
-            make_da3_request(tty_fd);
+    if (int sock = daemon_connect(); sock != -1) {
+      (void) daemon_send(sock, daemon_ops::invalidate, fd, "");
+      ::close(sock);
+    }
+
+    if (opened)
+      ::close(fd);
+  }
+
+
+  void info::set_unknown_log(const char* fname)
+  {
+    unknown_log_file = fname == nullptr ? "" : fname;
+  }
+
+
+  std::string info::metrics(metrics_formats format)
+  {
+    std::string res;
 
-          if (da3_reply == not_issued) {
-            make_osc702_request(tty_fd);
+    // Take a snapshot.  The values need not be consistent with each other.
+    std::array<uint64_t,max_implementations> detections;
+    std::array<uint64_t,max_implementations> requests;
+    std::array<uint64_t,max_implementations> timeouts;
+    for (size_t i = 0; i < max_implementations; ++i) {
+      detections[i] = counters.detections[i].load(std::memory_order_relaxed);
+      requests[i] = counters.requests[i].load(std::memory_order_relaxed);
+      timeouts[i] = counters.timeouts[i].load(std::memory_order_relaxed);
+    }
+    std::array<uint64_t,latency_buckets.size() + 1> latency;
+    for (size_t i = 0; i < latency.size(); ++i)
+      latency[i] = counters.latency[i].load(std::memory_order_relaxed);
+    auto sum = double(counters.latency_sum_ns.load(std::memory_order_relaxed)) / 1e9;
+    auto cache_hits = counters.cache_hits.load(std::memory_order_relaxed);
+
+    auto label = [](size_t i) {
+      auto name = implementation_name(implementations(i));
+      return name.empty() ? std::format("{}", i) : name;
+    };
 
-            // The code below assumes that we can identify rxvt via the OSC702 reply.
-            assert(! is_rxvt() || osc702_reply.starts_with("rxvt"));
+    if (format == metrics_formats::json) {
+      auto per_implementation = [&res,&label](const char* key, const auto& values) {
+        std::format_to(std::back_inserter(res), "\"{}\":{{", key);
+        const char* sep = "";
+        for (size_t i = 0; i < values.size(); ++i)
+          if (values[i] != 0) {
+            std::format_to(std::back_inserter(res), "{}\"{}\":{}", sep, label(i), values[i]);
+            sep = ",";
           }
-        }
+        res += "},";
+      };
+      res += '{';
+      per_implementation("detections", detections);
+      per_implementation("requests", requests);
+      per_implementation("timeouts", timeouts);
+      std::format_to(std::back_inserter(res), "\"cache_hits\":{},", cache_hits);
+      res += "\"latency\":{\"buckets\":[";
+      uint64_t total = 0;
+      for (size_t i = 0; i < latency.size(); ++i) {
+        total += latency[i];
+        if (i < latency_buckets.size())
+          std::format_to(std::back_inserter(res), "[{},{}],", double(latency_buckets[i]) / 1000.0, total);
+        else
+          std::format_to(std::back_inserter(res), "[null,{}]", total);
+      }
+      std::format_to(std::back_inserter(res), "],\"sum\":{},\"count\":{}}}}}\n", sum, total);
+    } else {
+      auto per_implementation = [&res,&label](const char* name, const char* help, const auto& values) {
+        std::format_to(std::back_inserter(res), "# HELP termdetect_{0} {1}\n# TYPE termdetect_{0} counter\n", name, help);
+        for (size_t i = 0; i < values.size(); ++i)
+          if (values[i] != 0)
+            std::format_to(std::back_inserter(res), "termdetect_{}{{implementation=\"{}\"}} {}\n", name, label(i), values[i]);
+      };
+      per_implementation("detections_total", "Number of detections.", detections);
+      per_implementation("requests_total", "Number of requests sent to the terminal.", requests);
+      per_implementation("timeouts_total", "Number of requests without complete reply.", timeouts);
+      std::format_to(std::back_inserter(res), "# HELP termdetect_cache_hits_total Number of results taken from the cache.\n# TYPE termdetect_cache_hits_total counter\ntermdetect_cache_hits_total {}\n", cache_hits);
+      res += "# HELP termdetect_detection_seconds Duration of the detection.\n# TYPE termdetect_detection_seconds histogram\n";
+      uint64_t total = 0;
+      for (size_t i = 0; i < latency.size(); ++i) {
+        total += latency[i];
+        if (i < latency_buckets.size())
+          std::format_to(std::back_inserter(res), "termdetect_detection_seconds_bucket{{le=\"{}\"}} {}\n", double(latency_buckets[i]) / 1000.0, total);
+        else
+          std::format_to(std::back_inserter(res), "termdetect_detection_seconds_bucket{{le=\"+Inf\"}} {}\n", total);
       }
+      std::format_to(std::back_inserter(res), "termdetect_detection_seconds_sum {}\ntermdetect_detection_seconds_count {}\n", sum, total);
+    }
 
-      if (close_fd)
-        ::close(tty_fd);
-
-      raw = std::format("TN={}, DA1={}, DA2={}, DA3={}, OSC702={}, Q={}", tn_reply, da1_reply, da2_reply, da3_reply, osc702_reply, q_reply);
-
-      // We are ready to determine the implementation.
-      if (is_st())
-        implementation = implementations::st;
-      else if (da3_reply == "7E565445")
-        implementation = implementations::vte;
-      else if (da3_reply == "464f4f54")
-        implementation = implementations::foot;
-      else if (is_terminology())
-        implementation = implementations::terminology;
-      else if (is_contour())
-        implementation = implementations::contour;
-      else if (is_xterm())
-        implementation = implementations::xterm;
-      else if (is_mrxvt())
-        implementation = implementations::mrxvt;
-      else if (osc702_reply.starts_with("rxvt"))
-        implementation = implementations::rxvt;
-      else if (is_kitty())
-        implementation = implementations::kitty;
-      else if (is_alacritty())
-        implementation = implementations::alacritty;
-      else if (is_konsole())
-        implementation = implementations::konsole;
-      else if (is_qt5())
-        implementation = implementations::qt5;
-
-      // Determine the implementation version.
-      if (implementation_version.empty()) {
-        if (is_terminology()) {
-          // Terminology does not fill DA2 replies with appropriate version information.  Use the CSI > q reply.
-          assert(! q_reply.empty());
-          implementation_version = q_reply.substr(12);
-        } else if (is_konsole()) {
-          // Konsole does not fill DA2 replies with appropriate version information.  Use the CSI > q reply.
-          assert(! q_reply.empty());
-          implementation_version = q_reply.substr(8);
-        } else if (is_kitty() && q_reply.starts_with("kitty(") && q_reply.ends_with(")") && q_reply.size() > 7)
-          implementation_version = q_reply.substr(6, q_reply.size() - 7);
-        else {
-          if (is_rxvt())
-            // rxvt encodes the version number as Mm (major/minor) in two digits.
-            vn = (vn / 10) * 10000 + (vn % 10) * 100;
-          else if (is_kitty() && vn > 400000)
-            // For some reason kitty adds 4000 to the first number.
-            vn = (vn - 400000) * 100;
-          else if (is_xterm())
-            // XTerm version numbers are > 100 and there is not even a minor version number.
-            vn *= 10000;
-          else if (is_vte())
-            // Ignore the last number after all.
-            vn /= 100;
-
-          // Not all implementations provide a patch number.
-          if (vn % 10000 == 0)
-            implementation_version = std::format("{}", vn / 10000);
-          else if (vn % 100 == 0)
-            implementation_version = std::format("{}.{}", vn / 10000, (vn / 100) % 100);
-          else
-            implementation_version = std::format("{}.{}.{}", vn / 10000, (vn / 100) % 100, vn % 100);
-        }
+    return res;
+  }
+
+
+  void info::set_transcript(const char* fname)
+  {
+    transcript_file = fname == nullptr ? "" : fname;
+  }
+
+
+  void fd_transport::enter_raw()
+  {
+    syscalls += 2;
+    ::tcgetattr(fd, &saved);
+    termios t_new = saved;
+    ::cfmakeraw(&t_new);
+    // Keep software flow control, serial lines might depend on it.
+    t_new.c_iflag |= saved.c_iflag & (IXON | IXOFF);
+    ::tcsetattr(fd, TCSAFLUSH, &t_new);
+  }
+
+
+  unsigned fd_transport::speed()
+  {
+    if (line_speed < 0) {
+      line_speed = 0;
+
+      // Pseudo terminals, the virtual consoles, and others (e.g., hvc consoles) report a speed as well but there
+      // is no line.  Only the ttyS devices and drivers which implement TIOCGSERIAL are serial lines.
+      struct stat st;
+      ++syscalls;
+      if (! info::stat_device(fd, st))
+        return 0;
+      if (major(st.st_rdev) != 4 || minor(st.st_rdev) < 64) {
+        serial_struct ser;
+        ++syscalls;
+        if (::ioctl(fd, TIOCGSERIAL, &ser) != 0)
+          return 0;
       }
 
-      if (is_alacritty() && emulation == emulations::vt100) {
-        std::string da1_extended = da1_reply + ";";
-        for (const auto& e : known_emulations)
-          if (da1_extended.starts_with(std::get<const char*>(e))) {
-            emulation = std::get<emulations>(e);
-            break;
-          }
+      termios t;
+      ++syscalls;
+      if (::tcgetattr(fd, &t) == 0) {
+        auto ispeed = ::cfgetispeed(&t);
+        auto ospeed = ::cfgetospeed(&t);
+        for (const auto& [code, bps] : known_speeds)
+          if (code == ospeed || (ispeed != B0 && code == ispeed))
+            // The slower direction is the one that matters.
+            line_speed = line_speed == 0 ? int(bps) : std::min(line_speed, int(bps));
       }
+    }
+
+    return unsigned(line_speed);
+  }
+
 
-      // Add features which are not discovered automatically.
-      if (is_kitty())
-        // OSC777 supported.
-        feature_set.insert(features::desktopnotification);
+  void fd_transport::leave_raw()
+  {
+    ++syscalls;
+    ::tcsetattr(fd, TCSAFLUSH, &saved);
+  }
 
-      // Unless demonstrated otherwise, assume that the terminal has DECSTBM support.
-      feature_set.insert(features::decstbm);
+
+  bool fd_transport::write(std::string_view request)
+  {
+    // Long requests might not fit into the buffer of the terminal device at once.
+    while (! request.empty()) {
+      ++syscalls;
+      auto n = ::write(fd, request.data(), request.size());
+      if (n > 0)
+        request.remove_prefix(n);
+      else if (n < 0 && errno == EAGAIN) {
+        pollfd pfds[1] {
+          { fd, POLLOUT, 0 }
+        };
+        ++syscalls;
+        if (::poll(pfds, 1, request_delay.value_or(get_default_request_delay())) <= 0)
+          return false;
+      } else if (n == 0 || errno != EINTR)
+        return false;
     }
+    return true;
   }
 
 
-  const std::shared_ptr<info> info::alloc(bool close_fd)
+  int fd_transport::wait(int timeout)
   {
-    return std::make_shared<info_impl>(close_fd);
+    pollfd pfds[1] {
+      { fd, POLLIN, 0 }
+    };
+    ++syscalls;
+    return ::poll(pfds, 1, timeout);
   }
 
 
-  void info::set_request_delay(int ms)
+  ssize_t fd_transport::read(char* buf, size_t len)
   {
-    request_delay = ms;
+    ++syscalls;
+    return ::read(fd, buf, len);
   }
 
 
   std::string info::implementation_name() const
   {
-    auto real_this = reinterpret_cast<const info_impl*>(this);
+    auto res = implementation_name(implementation);
 
-    std::string res;
+    if (res.empty()) {
+      auto real_this = reinterpret_cast<const info_impl*>(this);
+
+      for (auto b : real_this->da3_reply)
+        if (isprint(b))
+          res += b;
+        else
+          std::format_to(std::back_inserter(res), "\\x{:02x}", b);
+    }
+
+    return res;
+  }
 
-    switch (implementation) {
+
+  std::string info::implementation_name(implementations impl)
+  {
+    switch (impl) {
     case implementations::unknown:
-      res = "unknown";
-      break;
+      return "unknown";
     case implementations::vte:
-      res = "VTE-based";
-      break;
+      return "VTE-based";
     case implementations::foot:
-      res = "Foot";
-      break;
+      return "Foot";
     case implementations::terminology:
-      res = "Terminology";
-      break;
+      return "Terminology";
     case implementations::contour:
-      res = "Contour";
-      break;
+      return "Contour";
     case implementations::xterm:
-      res = "XTerm";
-      break;
+      return "XTerm";
     case implementations::rxvt:
-      res = "rxvt";
-      break;
+      return "rxvt";
     case implementations::mrxvt:
-      res = "mrxvt";
-      break;
+      return "mrxvt";
     case implementations::kitty:
-      res = "Kitty";
-      break;
+      return "Kitty";
     case implementations::alacritty:
-      res = "Alacritty";
-      break;
+      return "Alacritty";
     case implementations::st:
-      res = "st";
-      break;
+      return "st";
     case implementations::konsole:
-      res = "Konsole";
-      break;
+      return "Konsole";
     case implementations::eterm:
-      res = "ETerm";
-      break;
+      return "ETerm";
     case implementations::emacsterm:
-      res = "Emacs Term";
-      break;
+      return "Emacs Term";
     case implementations::qt5:
-      res = "Qt5";
-      break;
+      return "Qt5";
+    case implementations::linuxconsole:
+      return "Linux console";
     default:
-      for (auto b : real_this->da3_reply)
-        if (isprint(b))
-          res += b;
-        else
-          std::format_to(std::back_inserter(res), "\\x{:02x}", b);
-      break;
+      return "";
     }
-
-    return res;
   }
 
 
@@ -883,27 +3210,248 @@ namespace terminal {
       return "recteditcontour";
     case features::desktopnotification:
       return "desktopnotification";
+    case features::decstbm:
+      return "decstbm";
+    case features::inband_resize:
+      return "inbandresize";
+    case features::bracketed_paste:
+      return "bracketedpaste";
+    case features::focus_events:
+      return "focusevents";
+    case features::sgr_mouse:
+      return "sgrmouse";
+    case features::alternate_screen:
+      return "altscreen";
+    case features::synchronized_output:
+      return "syncoutput";
+    case features::kitty_keyboard:
+      return "kittykeyboard";
+    case features::truecolor:
+      return "truecolor";
     default:
       return std::format("unknown{}", std::to_underlying(feature));
     }
   }
 
 
+  std::string info::probe_name(probes probe)
+  {
+    switch (probe) {
+    case probes::da1:
+      return "DA1";
+    case probes::da2:
+      return "DA2";
+    case probes::da3:
+      return "DA3";
+    case probes::q:
+      return "Q";
+    case probes::tn:
+      return "TN";
+    case probes::osc702:
+      return "OSC702";
+    default:
+      return std::format("unknown{}", std::to_underlying(probe));
+    }
+  }
+
+
+  std::string info::outcome_name(probe_outcomes outcome)
+  {
+    switch (outcome) {
+    case probe_outcomes::answered:
+      return "answered";
+    case probe_outcomes::timed_out:
+      return "timed out";
+    case probe_outcomes::skipped:
+      return "skipped";
+    case probe_outcomes::error:
+      return "error";
+    default:
+      return std::format("unknown{}", std::to_underlying(outcome));
+    }
+  }
+
+
+  std::map<mode,mode_states> info::query_modes(std::span<const mode> modes, int fd)
+  {
+    std::map<mode,mode_states> res;
+
+    bool opened = fd == -1;
+    if (fd == -1) {
+      fd = ::open(_PATH_TTY, O_RDWR | O_NOCTTY | O_CLOEXEC);
+      if (fd == -1)
+        return res;
+    }
+
+    if (::isatty(fd)) {
+      fd_transport tr(fd);
+      auto reply = query(tr, mode_requests(modes));
+      if (auto found = extract_modes(reply); ! found.empty()) {
+        res = parse_mode_replies(found);
+        // The terminal implements DECRQM but has not answered for all the modes.
+        for (auto m : modes)
+          res.try_emplace(m, mode_states::not_recognized);
+      }
+    }
+
+    if (opened)
+      ::close(fd);
+
+    return res;
+  }
+
+
   std::optional<std::tuple<unsigned,unsigned>> info::get_geometry(int fd)
   {
     bool opened = fd == -1;
     if (fd == -1) {
-      fd = ::open(_PATH_TTY, O_RDWR | O_CLOEXEC | O_NOCTTY | O_CLOEXEC);
+      fd = ::open(_PATH_TTY, O_RDWR | O_NOCTTY | O_CLOEXEC);
       if (fd == -1)
         return std::nullopt;
     }
-    winsize ws;
-    auto r = ::ioctl(fd, TIOCGWINSZ, &ws);
+    auto res = kernel_geometry(fd);
+    if (! res)
+      res = cached_geometry(fd);
+    if (! res && ::isatty(fd)) {
+      fd_transport tr(fd);
+      auto reply = query(tr, GEOMETRY_REQUEST);
+      res = extract_geometry(reply);
+      if (res)
+        remember_geometry(fd, *res);
+    }
     if (opened)
       ::close(fd);
-    if (r == 0)
-      return std::make_tuple(unsigned(ws.ws_col), unsigned(ws.ws_row));
-    return std::nullopt;
+    return res;
+  }
+
+
+
+  geometry_tracker::geometry_tracker(int fd_)
+  : fd(fd_)
+  {
+    if (fd == -1) {
+      fd = ::open(_PATH_TTY, O_RDWR | O_NOCTTY | O_CLOEXEC);
+      own_fd = fd != -1;
+    }
+
+    install_winch_handler();
+    seen = winch_count.load(std::memory_order_relaxed);
+
+    if (fd == -1 || ! ::isatty(fd))
+      return;
+
+    // Many emulators do not set the pixel sizes.  The cell size does not change when the window is resized,
+    // asking once is enough.
+    winsize ws;
+    if (::ioctl(fd, TIOCGWINSZ, &ws) != 0 || ws.ws_xpixel == 0 || ws.ws_ypixel == 0) {
+      fd_transport tr(fd);
+      auto reply = query(tr, PIXELS_REQUEST);
+      for (const auto& params : extract_reports(reply, WINOP_REPLY_SUFFIX[0]))
+        if (params.size() == 3 && params[0] == CELL_PIXELS_REPLY) {
+          cell_width = params[2];
+          cell_height = params[1];
+        } else if (params.size() == 3 && params[0] == TEXT_AREA_PIXELS_REPLY && cell_width == 0) {
+          // Not all emulators report the cell size.  Derive it from the size of the text area.
+          if (auto size = info::get_geometry(fd); size && std::get<0>(*size) != 0 && std::get<1>(*size) != 0) {
+            cell_width = params[2] / std::get<0>(*size);
+            cell_height = params[1] / std::get<1>(*size);
+          }
+        }
+    }
+
+    refresh();
+  }
+
+
+  geometry_tracker::~geometry_tracker()
+  {
+    if (inband.load(std::memory_order_relaxed))
+      (void) ::write(fd, CSI INBAND_RESIZE_MODE "l", strlen(CSI INBAND_RESIZE_MODE "l"));
+    if (own_fd)
+      ::close(fd);
+  }
+
+
+  bool geometry_tracker::enable_inband_resize()
+  {
+    if (fd == -1)
+      return false;
+
+    // Without support for the mode no reports would come and the signal must not be ignored.
+    const mode inband_mode[] { { 2048 } };
+    std::lock_guard guard(query_lock);
+    auto state = info::query_modes(inband_mode, fd)[inband_mode[0]];
+    if (state != mode_states::set && state != mode_states::reset && state != mode_states::permanently_set)
+      return false;
+
+    if (::write(fd, CSI INBAND_RESIZE_MODE "h", strlen(CSI INBAND_RESIZE_MODE "h")) != ssize_t(strlen(CSI INBAND_RESIZE_MODE "h")))
+      return false;
+    inband.store(true, std::memory_order_relaxed);
+    return true;
+  }
+
+
+  bool geometry_tracker::process_input(std::string& input)
+  {
+    bool res = false;
+    for (const auto& params : extract_reports(input, WINOP_REPLY_SUFFIX[0], INBAND_RESIZE_REPLY))
+      if (params.size() == 5) {
+        set(params[2], params[1], params[4], params[3]);
+        res = true;
+      }
+    return res;
+  }
+
+
+  geometry geometry_tracker::get() const
+  {
+    // With in-band reports the signal is redundant.
+    if (auto n = winch_count.load(std::memory_order_relaxed); n != seen.load(std::memory_order_relaxed) && ! inband.load(std::memory_order_relaxed)) {
+      seen.store(n, std::memory_order_relaxed);
+      refresh();
+    }
+
+    auto v = packed.load(std::memory_order_relaxed);
+    geometry res;
+    res.columns = v & 0xffff;
+    res.rows = (v >> 16) & 0xffff;
+    res.width = (v >> 32) & 0xffff;
+    res.height = v >> 48;
+    if (res.columns != 0 && res.rows != 0) {
+      res.cell_width = res.width / res.columns;
+      res.cell_height = res.height / res.rows;
+    }
+    return res;
+  }
+
+
+  void geometry_tracker::refresh() const
+  {
+    if (fd == -1)
+      return;
+
+    winsize ws;
+    if (::ioctl(fd, TIOCGWINSZ, &ws) != 0 || ws.ws_col == 0 || ws.ws_row == 0) {
+      // The kernel does not know the size.  There are no signals in this case either.
+      std::lock_guard guard(query_lock);
+      auto size = info::get_geometry(fd);
+      if (! size)
+        return;
+      set(std::get<0>(*size), std::get<1>(*size), 0, 0);
+    } else
+      set(ws.ws_col, ws.ws_row, ws.ws_xpixel, ws.ws_ypixel);
+  }
+
+
+  void geometry_tracker::set(unsigned columns, unsigned rows, unsigned width, unsigned height) const
+  {
+    if (width == 0 || height == 0) {
+      width = cell_width * columns;
+      height = cell_height * rows;
+    }
+
+    packed.store(uint64_t(std::min(columns, 0xffffu)) | uint64_t(std::min(rows, 0xffffu)) << 16
+                 | uint64_t(std::min(width, 0xffffu)) << 32 | uint64_t(std::min(height, 0xffffu)) << 48, std::memory_order_relaxed);
   }
 
 } // namespace terminal
@@ -1,13 +1,25 @@
 #ifndef _TERMDETECT_HH
 #define _TERMDETECT_HH 1
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
+#include <span>
 #include <string>
+#include <string_view>
 #include <tuple>
+#include <vector>
 
+#include <termios.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 
 namespace terminal {
@@ -28,6 +40,7 @@ namespace terminal {
     eterm,
     emacsterm,
     qt5,
+    linuxconsole,             // Linux virtual console
   };
 
 
@@ -81,27 +94,305 @@ namespace terminal {
     recteditcontour,
     desktopnotification,      // OSC777
     decstbm,                  // DECSTBM, CSI n1;n1r
+    inband_resize,            // Mode 2048, window size reports in the input
+    bracketed_paste,          // Mode 2004
+    focus_events,             // Mode 1004
+    sgr_mouse,                // Mode 1006, mouse reports in SGR format
+    alternate_screen,         // Mode 1049
+    synchronized_output,      // Mode 2026, updates between CSI ? 2026 h and l are shown at once
+    kitty_keyboard,           // Kitty keyboard protocol, CSI > FLAGS u
+    truecolor,                // 24-bit colors, CSI 38 ; 2 ; R ; G ; B m
+  };
+
+
+  // A color with eight bits per channel.
+  struct rgb {
+    uint8_t r = 0;
+    uint8_t g = 0;
+    uint8_t b = 0;
+
+    auto operator<=>(const rgb&) const = default;
+  };
+
+
+  // A mode as used in SM and RM (ANSI modes) or DECSET and DECRST (DEC private modes).
+  struct mode {
+    unsigned number;
+    bool dec_private = true;
+
+    auto operator<=>(const mode&) const = default;
+  };
+
+
+  // The states of modes as reported by DECRQM.
+  enum struct mode_states : uint8_t {
+    not_recognized = 0,
+    set,
+    reset,
+    permanently_set,
+    permanently_reset,
+  };
+
+
+  // The requests used to determine the emulator.
+  enum struct probes {
+    da1,
+    da2,
+    da3,
+    q,
+    tn,
+    osc702,
+  };
+
+
+  enum struct probe_outcomes {
+    answered,
+    timed_out,                // No or incomplete reply before the request delay expired.
+    skipped,                  // Not needed for this emulator.
+    error,
+  };
+
+
+  // Timing and result of one request.  The times are relative to the start of the detection.
+  struct probe_record {
+    probes probe;
+    // The bytes actually written, including the requests sent together with this one.
+    std::string request { };
+    std::chrono::nanoseconds sent { };
+    std::chrono::nanoseconds first_byte { };
+    std::chrono::nanoseconds complete { };
+    size_t bytes = 0;
+    probe_outcomes outcome = probe_outcomes::skipped;
+  };
+
+
+  enum struct metrics_formats {
+    prometheus,
+    json,
+  };
+
+
+  // Messages exchanged with the termdetectd daemon over a Unix domain socket of type SOCK_SEQPACKET.
+  // Each message is a header followed by LEN bytes of payload.  Requests carry the file descriptor of
+  // the terminal as SCM_RIGHTS ancillary data.  The payload of a lookup is the value of TERM and of
+  // COLORTERM, separated by a NUL byte, so that the daemon classifies with the client's values.  The
+  // daemon answers with found, the replies in the format of info::raw plus TERM as the payload, or
+  // first with pending if the detection has to be performed.
+  enum struct daemon_ops : uint8_t {
+    lookup,
+    invalidate,
+    found,
+    pending,
+    failed,
+  };
+
+  struct daemon_header {
+    uint8_t version;
+    daemon_ops op;
+    uint16_t len;
+  };
+
+  constexpr uint8_t daemon_version = 2;
+
+
+  // Special strings used in place of a reply to indicate that the request never was issued
+  // or that the terminal did not answer.
+  constexpr auto not_issued = "<NOT ISSUED>";
+  constexpr auto no_reply = "<NO REPLY>";
+
+
+  // The replies of the terminal emulator to the individual requests.  This is all the information
+  // the classification depends on and it is exactly what info::raw reports.
+  struct replies {
+    std::string tn = not_issued;
+    std::string da1 = not_issued;
+    std::string da2 = not_issued;
+    std::string da3 = not_issued;
+    std::string osc702 = not_issued;
+    std::string q = not_issued;
+    // Replies to DECRQM, the parameters of each separated by commas.
+    std::string modes = not_issued;
+    // Reply to the kitty keyboard protocol query, the enabled flags.
+    std::string keyboard = not_issued;
+    // The capabilities out of RGB and Tc which XTGETTCAP reports, separated by commas.
+    std::string tcap = not_issued;
+    // Reply to DECRQSS for SGR after setting a direct color.
+    std::string sgr = not_issued;
+    // Line speed in bits per second for serial lines, empty otherwise.
+    std::string speed { };
+    // Foreground, background, and palette colors in hex, if they were requested.
+    std::string colors = not_issued;
+    // Value of the TERM environment variable.  Some emulators can only be recognized this way.
+    std::string term { };
+
+    // Parse a string in the format of info::raw.  An additional TERM=... field is recognized.
+    static std::optional<replies> parse(std::string_view raw);
+  };
+
+
+  // The channel through which the requests are sent and the replies are received.  The default
+  // is the terminal device.  Other implementations record or replay the exchange.
+  struct transport {
+    virtual ~transport() = default;
+
+    // Switch the terminal into raw mode while a request is made and back.
+    virtual void enter_raw() { }
+    virtual void leave_raw() { }
+
+    // Send a request.  Returns true if all bytes are written.
+    virtual bool write(std::string_view request) = 0;
+    // Wait up to TIMEOUT milliseconds for input.  Returns a positive value if input is available,
+    // zero in case of a timeout, and a negative value in case of an error.
+    virtual int wait(int timeout) = 0;
+    // Read the available input.
+    virtual ssize_t read(char* buf, size_t len) = 0;
+
+    // Line speed in bits per second if the terminal is connected through a serial line, zero
+    // otherwise.  The timeouts are extended by the time it takes to transmit requests and replies.
+    virtual unsigned speed() { return 0; }
+
+    // Access the environment of the terminal session.
+    virtual const char* getenv(const char* name) { return ::getenv(name); }
+
+    // The clock used to measure time spent waiting.  Implementations which do not actually wait
+    // (e.g., simulations in virtual time) advance it in wait.
+    virtual std::chrono::steady_clock::time_point now() { return std::chrono::steady_clock::now(); }
+  };
+
+
+  // Transport using a file descriptor for a terminal device.
+  struct fd_transport : transport {
+    explicit fd_transport(int fd_) : fd(fd_) { }
+
+    void enter_raw() override;
+    void leave_raw() override;
+    bool write(std::string_view request) override;
+    int wait(int timeout) override;
+    ssize_t read(char* buf, size_t len) override;
+    unsigned speed() override;
+
+    // Number of system calls made so far, e.g., for benchmarks.  Resolving /dev/tty to the actual device
+    // counts as one.
+    unsigned long syscalls = 0;
+
+  private:
+    int fd;
+    termios saved { };
+    // Determined on first use, -1 before.
+    int line_speed = -1;
   };
 
 
   struct info {
     static const std::shared_ptr<info> alloc(bool close_fd = true);
+    // Perform the detection using the given transport instead of the terminal device.
+    static const std::shared_ptr<info> alloc(transport& tr);
+    // Determine the result purely from recorded replies, no terminal I/O is performed.
+    static const std::shared_ptr<info> classify(const replies& r);
 
     static void set_request_delay(int ms);
 
+    // Describe the requests the detection would make and the decisions it would take if the terminal
+    // gave the assumed replies, without any terminal I/O.  Replies which are not given are assumed to
+    // be missing.  The expected time assumes RTT for each answered request, the worst case a timeout
+    // for each request.
+    static std::string explain(const replies& assumed, std::chrono::microseconds rtt = std::chrono::microseconds::zero());
+
+    // Record the exchange with the terminal in the named file whenever alloc is called.  The
+    // TERMDETECT_TRANSCRIPT environment variable has the same effect.  Passing nullptr stops recording.
+    static void set_transcript(const char* fname);
+    // Perform the detection using a transcript recorded earlier.  Unless REALTIME is true the
+    // recorded delays are not reproduced.  Returns nullptr if the file cannot be read.
+    static const std::shared_ptr<info> replay(const char* fname, bool realtime = false);
+
+    // Keep the replies of the terminal in a per-user cache, in $XDG_RUNTIME_DIR/termdetect or
+    // /tmp/termdetect-UID, so that later calls of alloc for the same terminal need no requests.
+    // TERMDETECT_CACHE=1 in the environment has the same effect as enabling it.
+    static void set_cache(bool enable);
+
+    // Determine the emulator of a local session without terminal I/O, from the executable of the first
+    // ancestor process which does not use the terminal or, failing that, of the process holding the
+    // master side of the pseudo terminal.  Returns std::nullopt for remote sessions, inside terminal
+    // multiplexers or containers, and for unknown programs.
+    static std::optional<implementations> identify_by_process(int fd = -1);
+    // If the emulator can be determined this way alloc makes no requests at all.  The result then has
+    // no version, emulation, features, or colors, and info::raw shows no request as issued.
+    // TERMDETECT_PROCESS_WALK=1 in the environment has the same effect as enabling it.
+    static void set_process_walk(bool enable);
+
+    // Ask the termdetectd daemon before making any requests, if it is running.  This costs a system
+    // call or two if it is not.  TERMDETECT_DAEMON=1 in the environment has the same effect as
+    // enabling it.
+    static void set_daemon(bool enable);
+    // Path of the socket of the daemon.  Empty if there is no safe directory for it.  The directory
+    // is only created if CREATE is true, as the daemon does.
+    static std::string daemon_socket(bool create = false);
+    // Status of the terminal device FD refers to.  Unlike fstat this also returns the data of the
+    // actual device for descriptors for /dev/tty and /dev/console.
+    static bool stat_device(int fd, struct stat& st);
+    // Forget the results for the terminal in the cache and in the daemon.
+    static void invalidate(int fd = -1);
+
+    // Append the replies of emulators which are not recognized to the named file, together with the
+    // timing and the relevant environment variables.  Each fingerprint is logged only once and the
+    // file is not grown beyond a fixed size.  The TERMDETECT_UNKNOWN_LOG environment variable has the
+    // same effect.  Passing nullptr stops logging.
+    static void set_unknown_log(const char* fname);
+
+    // Statistics of all detections in the process.  If the TERMDETECT_METRICS environment variable
+    // names a file they are also written to it at exit; %p in the name is replaced by the process ID.
+    // The format is JSON if the name ends in .json and the Prometheus text format otherwise.
+    static std::string metrics(metrics_formats format = metrics_formats::prometheus);
+
+    // Ask the terminal for the foreground and background colors and the 256 palette entries in alloc.  All
+    // queries are sent at once and take one more round trip.  They are not sent to emulators which do not
+    // implement them.  TERMDETECT_PALETTE=1 in the environment has the same effect as enabling it.
+    static void set_palette_query(bool enable);
+    // The palette xterm uses by default: 16 ANSI colors, the 6x6x6 color cube, and 24 shades of gray.
+    static std::array<rgb,256> default_palette();
+
     implementations implementation = implementations::unknown;
     std::string implementation_version { };
     emulations emulation = emulations::unknown;
     std::set<features> feature_set { };
     std::string unknown_features { };
     std::string raw { };
+    // The states of the modes queried during the detection, empty if the terminal does not implement DECRQM.
+    std::map<mode,mode_states> modes { };
+    // Progressive enhancement flags of the kitty keyboard protocol enabled at the time of the detection.  Only
+    // valid if the feature is present.  If it is, a lone ESC in the input is the Esc key once flag 1 is set.
+    unsigned keyboard_flags = 0;
+    // Number of bits per color: 24 with the truecolor feature, 8 for 256 colors, 4 for the eight ANSI colors
+    // in two intensities, and zero if unknown.
+    unsigned color_depth = 0;
+
+    // The colors reported by the terminal if the palette is queried.
+    std::optional<rgb> foreground { };
+    std::optional<rgb> background { };
+    // Empty or 256 entries.  Entries the terminal does not report have the default values.
+    std::vector<rgb> palette { };
+
+    // One record for each request in the order they were made, followed by records for the
+    // requests which were skipped.  Empty if the result does not come from a detection.
+    std::vector<probe_record> probe_records { };
+    // Total time of the detection.
+    std::chrono::nanoseconds detection_time { };
 
     std::string implementation_name() const;
+    // Returns an empty string for values without a name.
+    static std::string implementation_name(implementations impl);
     std::string emulation_name() const;
     static std::string feature_name(features feature);
+    static std::string probe_name(probes probe);
+    static std::string outcome_name(probe_outcomes outcome);
 
     static std::optional<std::tuple<unsigned,unsigned>> get_geometry(int fd = -1);
 
+    // Query the states of the modes with DECRQM.  All requests are sent at once, followed by DA1 which all
+    // terminals answer, so this takes one round trip.  Modes the terminal does not report are not
+    // recognized.  The result is empty if the terminal does not implement DECRQM at all.
+    static std::map<mode,mode_states> query_modes(std::span<const mode> modes, int fd = -1);
+
     int get_fd() const { return tty_fd; }
     void close() { if (tty_fd != -1) { ::close(tty_fd); tty_fd = -1; } }
 
@@ -110,6 +401,60 @@ namespace terminal {
     int tty_fd = -1;
   };
 
+
+  // Size of the terminal in characters and pixels.  The pixel sizes are zero if unknown.
+  struct geometry {
+    unsigned columns = 0;
+    unsigned rows = 0;
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned cell_width = 0;
+    unsigned cell_height = 0;
+  };
+
+
+  // Keeps the size of the terminal available without a system call for each lookup.  The kernel is only asked
+  // again after a SIGWINCH signal.  The signal handler is installed with the first object and stays installed;
+  // it calls the handler which was installed before.  If the kernel does not know the pixel sizes the terminal
+  // is asked for the cell size once (CSI 16 t, or CSI 14 t for the size of the text area).
+  struct geometry_tracker {
+    // Use the terminal FD refers to, /dev/tty if it is -1.
+    explicit geometry_tracker(int fd = -1);
+    // Use the terminal of the detection if its file descriptor was kept open in alloc, /dev/tty otherwise.
+    explicit geometry_tracker(const info& ti) : geometry_tracker(ti.get_fd()) { }
+    geometry_tracker(const geometry_tracker&) = delete;
+    geometry_tracker& operator=(const geometry_tracker&) = delete;
+    ~geometry_tracker();
+
+    // Can be called concurrently from any number of threads.  If the kernel does not know the size the
+    // terminal is asked; only one thread at a time does this.
+    geometry get() const;
+
+    // Ask the terminal to report size changes in the input (mode 2048, see features::inband_resize).  The
+    // signal is ignored from then on.  The destructor disables the reports again.  Returns false, and nothing
+    // changes, if the terminal does not support the mode.
+    bool enable_inband_resize();
+    // Remove the size reports from the input read from the terminal and take over the size.  Returns true
+    // if there was a report.
+    bool process_input(std::string& input);
+
+  private:
+    void refresh() const;
+    void set(unsigned columns, unsigned rows, unsigned width, unsigned height) const;
+
+    int fd;
+    bool own_fd = false;
+    // Cell size reported by the terminal if the kernel does not know the pixel sizes.
+    unsigned cell_width = 0;
+    unsigned cell_height = 0;
+    // Columns, rows, width, and height in 16 bits each, just like in the kernel's winsize.
+    mutable std::atomic<uint64_t> packed = 0;
+    mutable std::atomic<unsigned> seen = 0;
+    std::atomic<bool> inband = false;
+    // Serializes the exchanges with the terminal, the replies of concurrent requests would be mixed.
+    mutable std::mutex query_lock { };
+  };
+
 } // namespace terminal
 
 #endif // termdetect.hh
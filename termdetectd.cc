@@ -0,0 +1,259 @@
+#include "termdetect.hh"
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <error.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+
+// Per-user daemon which performs the detection once for each terminal and answers the lookups of
+// info::alloc from all processes using the terminal.  The clients pass the file descriptor of the
+// terminal along with the request, the daemon uses it to make the requests itself if it does not
+// know the replies yet.  Concurrent lookups for the same terminal wait for the same detection.
+//
+// A result is used as long as the device node of the terminal is the same (pseudo terminals are
+// reused but the device node is created anew), TERM does not change, the result is not older than
+// the time-to-live, and it is not invalidated with info::invalidate, e.g., from a hook which runs
+// when a terminal multiplexer session is attached to a different emulator.
+
+namespace {
+
+  // What is known about a terminal device.
+  struct entry {
+    // Change time of the device node.
+    timespec ctime { };
+    std::string term { };
+    // Replies in the format of info::raw plus TERM, empty if not known.
+    std::string replies { };
+    std::chrono::steady_clock::time_point stored { };
+    bool pending = false;
+  };
+
+  std::mutex lock;
+  std::condition_variable changed;
+  std::map<dev_t,entry> entries;
+
+  std::chrono::seconds ttl { };
+
+
+  // Transport for the terminal of a client.  TERM and COLORTERM are taken from the client's environment.
+  struct client_transport final : terminal::fd_transport {
+    client_transport(int fd_, std::string_view term_, std::string_view colorterm_) : fd_transport(fd_), term(term_), colorterm(colorterm_) { }
+
+    const char* getenv(const char* name) override
+    {
+      if (strcmp(name, "TERM") == 0)
+        return term.empty() ? nullptr : term.c_str();
+      if (strcmp(name, "COLORTERM") == 0)
+        return colorterm.empty() ? nullptr : colorterm.c_str();
+      return fd_transport::getenv(name);
+    }
+
+  private:
+    std::string term;
+    std::string colorterm;
+  };
+
+
+  bool send_reply(int conn, terminal::daemon_ops op, std::string_view payload = "")
+  {
+    terminal::daemon_header h { terminal::daemon_version, op, uint16_t(payload.size()) };
+    std::string msg(reinterpret_cast<const char*>(&h), sizeof(h));
+    msg += payload;
+    return ::send(conn, msg.data(), msg.size(), MSG_NOSIGNAL) == ssize_t(msg.size());
+  }
+
+
+  bool valid(const entry& e, const struct stat& st, std::string_view term)
+  {
+    return ! e.replies.empty() && e.ctime.tv_sec == st.st_ctim.tv_sec && e.ctime.tv_nsec == st.st_ctim.tv_nsec && e.term == term
+           && (ttl == std::chrono::seconds::zero() || std::chrono::steady_clock::now() - e.stored < ttl);
+  }
+
+
+  void lookup(int conn, int fd, std::string_view payload)
+  {
+    auto sep = payload.find('\0');
+    auto term = payload.substr(0, sep);
+    auto colorterm = sep == std::string_view::npos ? std::string_view() : payload.substr(sep + 1);
+
+    struct stat st;
+    if (! terminal::info::stat_device(fd, st)) {
+      send_reply(conn, terminal::daemon_ops::failed);
+      return;
+    }
+
+    std::unique_lock guard(lock);
+    bool announced = false;
+    while (entries[st.st_rdev].pending) {
+      if (! announced) {
+        send_reply(conn, terminal::daemon_ops::pending);
+        announced = true;
+      }
+      changed.wait(guard);
+    }
+
+    // Entries are not removed while a detection is pending.
+    auto& e = entries[st.st_rdev];
+    if (! valid(e, st, term)) {
+      e.pending = true;
+      guard.unlock();
+      if (! announced)
+        send_reply(conn, terminal::daemon_ops::pending);
+
+      client_transport tr(fd, term, colorterm);
+      auto ti = terminal::info::alloc(tr);
+      std::string res = ti->raw + ", TERM=" + std::string(term);
+
+      guard.lock();
+      e.ctime = st.st_ctim;
+      e.term = term;
+      e.replies = std::move(res);
+      e.stored = std::chrono::steady_clock::now();
+      e.pending = false;
+      changed.notify_all();
+    }
+
+    auto res = e.replies;
+    guard.unlock();
+    send_reply(conn, terminal::daemon_ops::found, res);
+  }
+
+
+  void invalidate(int fd)
+  {
+    struct stat st;
+    if (! terminal::info::stat_device(fd, st))
+      return;
+
+    std::lock_guard guard(lock);
+    if (auto it = entries.find(st.st_rdev); it != entries.end() && ! it->second.pending)
+      entries.erase(it);
+  }
+
+
+  void serve(int conn)
+  {
+    // Only serve the own user.
+    ucred cred;
+    socklen_t credlen = sizeof(cred);
+    if (::getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) != 0 || cred.uid != ::getuid()) {
+      ::close(conn);
+      return;
+    }
+
+    while (true) {
+      char buf[4096];
+      iovec iov { buf, sizeof(buf) };
+      alignas(cmsghdr) char cbuf[CMSG_SPACE(sizeof(int))];
+      msghdr msg { };
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = cbuf;
+      msg.msg_controllen = sizeof(cbuf);
+      auto n = ::recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+      if (n <= 0)
+        break;
+
+      int fd = -1;
+      if (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+      terminal::daemon_header h;
+      if (n >= ssize_t(sizeof(h)))
+        memcpy(&h, buf, sizeof(h));
+      if (fd == -1 || n < ssize_t(sizeof(h)) || h.version != terminal::daemon_version || size_t(n) != sizeof(h) + h.len)
+        send_reply(conn, terminal::daemon_ops::failed);
+      else if (h.op == terminal::daemon_ops::lookup)
+        lookup(conn, fd, std::string_view(buf + sizeof(h), h.len));
+      else if (h.op == terminal::daemon_ops::invalidate)
+        invalidate(fd);
+      else
+        send_reply(conn, terminal::daemon_ops::failed);
+
+      if (fd != -1)
+        ::close(fd);
+    }
+
+    ::close(conn);
+  }
+
+} // anonymous namespace
+
+
+int main(int argc, char* argv[])
+{
+  std::string path;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:t:")) != -1)
+    switch (opt) {
+    case 's':
+      path = optarg;
+      break;
+    case 't':
+      ttl = std::chrono::seconds(atoi(optarg));
+      break;
+    default:
+      std::cerr << "Usage: " << argv[0] << " [-s SOCKET] [-t TTL-SECONDS]\n";
+      return EXIT_FAILURE;
+    }
+
+  // The daemon itself must never ask another daemon.
+  terminal::info::set_daemon(false);
+  terminal::info::set_cache(false);
+
+  if (path.empty())
+    path = terminal::info::daemon_socket(true);
+  sockaddr_un sun { };
+  sun.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(sun.sun_path))
+    error(EXIT_FAILURE, 0, "no usable socket path");
+  memcpy(sun.sun_path, path.data(), path.size());
+
+  int sock = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (sock == -1)
+    error(EXIT_FAILURE, errno, "cannot create socket");
+
+  // A socket left behind by a daemon which is not running anymore is removed.
+  if (::connect(sock, reinterpret_cast<const sockaddr*>(&sun), sizeof(sun)) == 0)
+    error(EXIT_FAILURE, 0, "daemon already running on %s", path.c_str());
+  ::close(sock);
+  ::unlink(path.c_str());
+
+  sock = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  auto oldmask = ::umask(077);
+  if (::bind(sock, reinterpret_cast<const sockaddr*>(&sun), sizeof(sun)) != 0)
+    error(EXIT_FAILURE, errno, "cannot bind to %s", path.c_str());
+  ::umask(oldmask);
+  if (::listen(sock, SOMAXCONN) != 0)
+    error(EXIT_FAILURE, errno, "cannot listen on %s", path.c_str());
+
+  // Terminals might go away while requests are made.
+  ::signal(SIGPIPE, SIG_IGN);
+
+  while (true) {
+    int conn = ::accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn == -1) {
+      if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE)
+        continue;
+      error(EXIT_FAILURE, errno, "accept failed");
+    }
+    std::thread(serve, conn).detach();
+  }
+}
@@ -0,0 +1,350 @@
+#include "termsim.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+
+namespace terminal::sim {
+
+  namespace {
+
+    // Translate the escape sequences used in profile files.
+    std::string unescape(std::string_view sv)
+    {
+      std::string res;
+
+      while (! sv.empty()) {
+        if (sv[0] != '\\' || sv.size() == 1) {
+          res += sv[0];
+          sv.remove_prefix(1);
+          continue;
+        }
+
+        switch (sv[1]) {
+        case 'e':
+          res += '\e';
+          break;
+        case 'a':
+          res += '\a';
+          break;
+        case 's':
+          res += ' ';
+          break;
+        case 'x':
+          if (sv.size() >= 4 && isxdigit(sv[2]) && isxdigit(sv[3])) {
+            res += char(std::stoi(std::string(sv.substr(2, 2)), nullptr, 16));
+            sv.remove_prefix(2);
+            break;
+          }
+          [[fallthrough]];
+        default:
+          res += sv[1];
+          break;
+        }
+        sv.remove_prefix(2);
+      }
+
+      return res;
+    }
+
+
+    std::chrono::microseconds from_ms(double ms)
+    {
+      return std::chrono::microseconds(std::llround(ms * 1000.0));
+    }
+
+
+    // Time to transmit the bytes over a serial line with one start and one stop bit.
+    std::chrono::microseconds transmission(unsigned baud, size_t nbytes)
+    {
+      return baud == 0 ? std::chrono::microseconds::zero() : std::chrono::microseconds(nbytes * 10 * 1'000'000 / baud);
+    }
+
+  } // anonymous namespace
+
+
+  std::optional<profile> profile::load(const char* fname)
+  {
+    std::ifstream in(fname);
+    if (! in)
+      return std::nullopt;
+
+    profile res;
+    std::string line;
+    while (std::getline(in, line)) {
+      std::string_view sv = line;
+      while (! sv.empty() && isspace(sv.back()))
+        sv.remove_suffix(1);
+      if (sv.empty() || sv[0] == '#')
+        continue;
+
+      auto sp = sv.find(' ');
+      auto key = sv.substr(0, sp);
+      auto value = sp == std::string_view::npos ? std::string_view() : sv.substr(sp + 1);
+
+      if (key == "name")
+        res.name = value;
+      else if (key == "term")
+        res.term = value;
+      else if (key == "expect")
+        res.expect = value;
+      else if (key == "expect-version")
+        res.expect_version = value;
+      else if (key == "reply") {
+        auto sp2 = value.find(' ');
+        res.replies[unescape(value.substr(0, sp2))] = sp2 == std::string_view::npos ? "" : unescape(value.substr(sp2 + 1));
+      } else if (key == "latency")
+        res.latency = std::stod(std::string(value));
+      else if (key == "jitter")
+        res.jitter = std::stod(std::string(value));
+      else if (key == "fragment")
+        res.fragment = std::stoul(std::string(value));
+      else if (key == "fragment-delay")
+        res.fragment_delay = std::stod(std::string(value));
+      else if (key == "drop")
+        res.drop = std::stod(std::string(value));
+      else if (key == "baud")
+        res.baud = std::stoul(std::string(value));
+      else if (key == "seed")
+        res.seed = std::stoul(std::string(value));
+      else
+        return std::nullopt;
+    }
+
+    return res;
+  }
+
+
+  std::vector<responder::chunk> responder::feed(std::string_view data)
+  {
+    std::vector<chunk> res;
+
+    pending.append(data);
+
+    size_t pos = 0;
+    while (pos < pending.size()) {
+      if (pending[pos] != '\e') {
+        // Regular output.
+        ++pos;
+        continue;
+      }
+      if (pos + 1 == pending.size())
+        break;
+
+      size_t end;
+      auto intro = pending[pos + 1];
+      if (intro == '[') {
+        // CSI sequences end with a byte in the range 0x40 to 0x7e.
+        end = pos + 2;
+        while (end < pending.size() && (pending[end] < 0x40 || pending[end] > 0x7e))
+          ++end;
+        if (end == pending.size())
+          break;
+        ++end;
+      } else if (intro == 'P' || intro == ']' || intro == '_' || intro == '^' || intro == 'X') {
+        // String sequences are terminated by ST.  OSC sequences can also be terminated by BEL.
+        auto st = pending.find("\e\\", pos + 2);
+        auto bel = intro == ']' ? pending.find('\a', pos + 2) : std::string::npos;
+        if (st == std::string::npos && bel == std::string::npos)
+          break;
+        end = std::min(st == std::string::npos ? st : st + 2, bel == std::string::npos ? bel : bel + 1);
+      } else
+        end = pos + 2;
+
+      auto seq = std::string_view(pending).substr(pos, end - pos);
+      pos = end;
+
+      auto it = prof.replies.find(seq);
+      if (it == prof.replies.end())
+        continue;
+      if (prof.drop > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(rng) < prof.drop)
+        continue;
+
+      auto delay = from_ms(prof.latency) + transmission(prof.baud, seq.size());
+      if (prof.jitter > 0.0)
+        delay += from_ms(std::uniform_real_distribution<double>(0.0, prof.jitter)(rng));
+
+      std::string_view reply = it->second;
+      if (prof.fragment == 0 || reply.size() <= prof.fragment)
+        res.emplace_back(delay + transmission(prof.baud, reply.size()), reply);
+      else
+        while (! reply.empty()) {
+          auto n = std::min(prof.fragment, reply.size());
+          delay += transmission(prof.baud, n);
+          res.emplace_back(delay, reply.substr(0, n));
+          reply.remove_prefix(n);
+          delay += from_ms(prof.fragment_delay);
+        }
+    }
+
+    pending.erase(0, pos);
+
+    return res;
+  }
+
+
+  void virtual_terminal::enter_raw()
+  {
+    // Like TCSAFLUSH, discard input which already arrived.
+    while (! queue.empty() && std::get<std::chrono::steady_clock::time_point>(queue.front()) <= clock)
+      queue.erase(queue.begin());
+  }
+
+
+  bool virtual_terminal::write(std::string_view request)
+  {
+    auto last = queue.empty() ? clock : std::get<std::chrono::steady_clock::time_point>(queue.back());
+    for (auto& [delay, data] : resp.feed(request)) {
+      last = std::max(last, clock + delay);
+      queue.emplace_back(last, std::move(data));
+    }
+    return true;
+  }
+
+
+  int virtual_terminal::wait(int timeout)
+  {
+    auto deadline = clock + std::chrono::milliseconds(timeout);
+    if (queue.empty() || std::get<std::chrono::steady_clock::time_point>(queue.front()) > deadline) {
+      clock = deadline;
+      ++timeouts;
+      return 0;
+    }
+
+    clock = std::max(clock, std::get<std::chrono::steady_clock::time_point>(queue.front()));
+    return 1;
+  }
+
+
+  ssize_t virtual_terminal::read(char* buf, size_t len)
+  {
+    size_t n = 0;
+    while (! queue.empty() && std::get<std::chrono::steady_clock::time_point>(queue.front()) <= clock && n < len) {
+      auto& data = std::get<std::string>(queue.front());
+      auto m = std::min(len - n, data.size());
+      memcpy(buf + n, data.data(), m);
+      n += m;
+      if (m == data.size())
+        queue.erase(queue.begin());
+      else
+        data.erase(0, m);
+    }
+
+    if (n == 0) {
+      errno = EAGAIN;
+      return -1;
+    }
+    return n;
+  }
+
+
+  const char* virtual_terminal::getenv(const char* name)
+  {
+    // The terminal type is determined by the profile.
+    if (strcmp(name, "TERM") == 0)
+      return term.c_str();
+    return transport::getenv(name);
+  }
+
+
+  simulator::simulator(const profile& p)
+  : resp(p)
+  {
+    master_fd = ::posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master_fd == -1)
+      return;
+    char name[64];
+    if (::grantpt(master_fd) != 0 || ::unlockpt(master_fd) != 0 || ::ptsname_r(master_fd, name, sizeof(name)) != 0
+        || (slave_fd = ::open(name, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC)) == -1
+        || ::pipe2(wakeup, O_CLOEXEC) != 0) {
+      ::close(master_fd);
+      master_fd = -1;
+      if (slave_fd != -1)
+        ::close(slave_fd);
+      slave_fd = -1;
+      return;
+    }
+
+    winsize ws { };
+    ws.ws_row = 24;
+    ws.ws_col = 80;
+    ::ioctl(slave_fd, TIOCSWINSZ, &ws);
+
+    worker = std::thread(&simulator::run, this);
+  }
+
+
+  simulator::~simulator()
+  {
+    if (worker.joinable()) {
+      done = true;
+      (void) ::write(wakeup[1], "", 1);
+      worker.join();
+    }
+    for (auto fd : { master_fd, slave_fd, wakeup[0], wakeup[1] })
+      if (fd != -1)
+        ::close(fd);
+  }
+
+
+  void simulator::run()
+  {
+    using clock = std::chrono::steady_clock;
+
+    // Pieces of replies in the order they are sent.  A reply never overtakes an earlier one.
+    std::deque<std::tuple<clock::time_point,std::string>> queue;
+    auto last = clock::now();
+
+    while (! done) {
+      timespec ts;
+      timespec* tsp = nullptr;
+      if (! queue.empty()) {
+        auto left = std::max(std::get<clock::time_point>(queue.front()) - clock::now(), clock::duration::zero());
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+        ts.tv_sec = ns / 1'000'000'000;
+        ts.tv_nsec = ns % 1'000'000'000;
+        tsp = &ts;
+      }
+
+      pollfd pfds[2] {
+        { master_fd, POLLIN, 0 },
+        { wakeup[0], POLLIN, 0 },
+      };
+      if (::ppoll(pfds, 2, tsp, nullptr) < 0)
+        continue;
+      if (pfds[1].revents != 0)
+        break;
+
+      if ((pfds[0].revents & POLLIN) != 0) {
+        char buf[4096];
+        auto n = ::read(master_fd, buf, sizeof(buf));
+        if (n > 0) {
+          auto now = clock::now();
+          for (auto& [delay, data] : resp.feed(std::string_view(buf, n))) {
+            last = std::max(last, now + delay);
+            queue.emplace_back(last, std::move(data));
+          }
+        }
+      }
+
+      auto now = clock::now();
+      while (! queue.empty() && std::get<clock::time_point>(queue.front()) <= now) {
+        auto& data = std::get<std::string>(queue.front());
+        (void) ::write(master_fd, data.data(), data.size());
+        queue.pop_front();
+      }
+    }
+  }
+
+} // namespace terminal::sim
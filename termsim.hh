@@ -0,0 +1,127 @@
+#ifndef _TERMSIM_HH
+#define _TERMSIM_HH 1
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "termdetect.hh"
+
+
+namespace terminal::sim {
+
+  // Description of the behavior of a terminal emulator.  Profiles are read from files with one
+  // directive per line:
+  //
+  //   name NAME                  name of the profile
+  //   term VALUE                 value of TERM to use with the emulator
+  //   expect NAME                expected result of info::implementation_name()
+  //   expect-version VERSION     expected implementation version
+  //   reply REQUEST REPLY        reply to REQUEST; the reply is the rest of the line
+  //   latency MS                 delay before a reply is sent
+  //   jitter MS                  maximal random additional delay
+  //   fragment BYTES             send replies in pieces of at most this size
+  //   fragment-delay MS          delay between the pieces
+  //   drop PROBABILITY           probability that a reply is lost
+  //   baud BITS-PER-SECOND       speed of a serial line; requests and replies take time to transmit
+  //   seed NUMBER                seed for the random number generator
+  //
+  // Empty lines and lines starting with # are ignored.  In requests and replies \e, \a, \\, \s
+  // (for a space), and \xHH are recognized.  Requests without reply are ignored by the emulator.
+  struct profile {
+    std::string name { };
+    std::string term { };
+    std::string expect { };
+    std::string expect_version { };
+    std::map<std::string,std::string,std::less<>> replies { };
+    double latency = 0.0;
+    double jitter = 0.0;
+    size_t fragment = 0;
+    double fragment_delay = 0.0;
+    double drop = 0.0;
+    unsigned baud = 0;
+    unsigned seed = 1;
+
+    static std::optional<profile> load(const char* fname);
+  };
+
+
+  // Split the output of the program into control sequences and determine the replies according to
+  // the profile.  This part knows nothing about time passing.
+  struct responder {
+    explicit responder(const profile& p) : prof(p), rng(p.seed) { }
+
+    // A piece of a reply and the delay after the request was received.
+    using chunk = std::tuple<std::chrono::microseconds,std::string>;
+
+    // Process output of the program.  Incomplete control sequences are kept for the next call.
+    std::vector<chunk> feed(std::string_view data);
+
+  private:
+    const profile& prof;
+    std::mt19937 rng;
+    std::string pending { };
+  };
+
+
+  // Simulated terminal emulator in virtual time.  Nothing ever sleeps: waiting for input advances
+  // the clock either to the time the next piece of a reply is due or by the full timeout.  The
+  // detection result and the time it would have taken are therefore exactly reproducible.
+  struct virtual_terminal final : transport {
+    explicit virtual_terminal(const profile& p) : resp(p), term(p.term), baud(p.baud) { }
+
+    void enter_raw() override;
+    bool write(std::string_view request) override;
+    int wait(int timeout) override;
+    ssize_t read(char* buf, size_t len) override;
+    const char* getenv(const char* name) override;
+    unsigned speed() override { return baud; }
+    std::chrono::steady_clock::time_point now() override { return clock; }
+
+    // Virtual time passed since the creation of the object.
+    std::chrono::microseconds elapsed() const { return std::chrono::duration_cast<std::chrono::microseconds>(clock - std::chrono::steady_clock::time_point { }); }
+
+    unsigned timeouts = 0;
+
+  private:
+    responder resp;
+    std::string term;
+    unsigned baud;
+    std::chrono::steady_clock::time_point clock { };
+    // Pieces of replies and the time they are available.
+    std::vector<std::tuple<std::chrono::steady_clock::time_point,std::string>> queue { };
+  };
+
+
+  // Simulated terminal emulator on a pseudo terminal.  The program under test uses the slave side,
+  // the simulator answers on the master side in a separate thread.
+  struct simulator {
+    explicit simulator(const profile& p);
+    simulator(const simulator&) = delete;
+    simulator& operator=(const simulator&) = delete;
+    ~simulator();
+
+    // File descriptor of the terminal side.  -1 if the pseudo terminal could not be created.
+    int slave() const { return slave_fd; }
+
+  private:
+    void run();
+
+    responder resp;
+    int master_fd = -1;
+    int slave_fd = -1;
+    int wakeup[2] { -1, -1 };
+    std::atomic<bool> done = false;
+    std::thread worker { };
+  };
+
+} // namespace terminal::sim
+
+#endif // termsim.hh
@@ -0,0 +1,196 @@
+#include "termdetect.hh"
+#include "termsim.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <unistd.h>
+
+
+// Exercise the timeout paths of the detection in virtual time.  With a request delay of half a second
+// the unknown emulator alone would take several seconds in real time.
+
+namespace {
+
+  constexpr int delay = 500;
+
+  const struct {
+    const char* profile;
+    unsigned timeouts;
+  } expected_timeouts[] {
+    { "alacritty", 0 },
+    { "contour", 0 },
+    { "emacsterm", 6 },
+    { "eterm", 2 },
+    { "foot", 0 },
+    { "kitty", 0 },
+    { "konsole", 0 },
+    { "linux", 1 },
+    { "mrxvt", 0 },
+    { "qt5", 0 },
+    { "rxvt", 0 },
+    { "st", 1 },
+    { "terminology", 0 },
+    { "vt220", 0 },
+    { "vte", 0 },
+    { "xterm", 0 },
+  };
+
+
+  bool check(const terminal::sim::profile& prof, unsigned timeouts, const char* variant)
+  {
+    terminal::sim::virtual_terminal tr(prof);
+    auto ti = terminal::info::alloc(tr);
+
+    bool ok = true;
+    if (ti->implementation_name() != prof.expect) {
+      std::cout << prof.name << " (" << variant << "): got " << ti->implementation_name() << ", expected " << prof.expect << std::endl;
+      ok = false;
+    }
+    if (tr.timeouts != timeouts) {
+      std::cout << prof.name << " (" << variant << "): " << tr.timeouts << " timeouts, expected " << timeouts << std::endl;
+      ok = false;
+    }
+    // The probe records must account for all timeouts and the whole time.
+    auto timed_out = std::ranges::count_if(ti->probe_records, [](const auto& r) { return r.outcome == terminal::probe_outcomes::timed_out && r.bytes == 0; });
+    if (unsigned(timed_out) != tr.timeouts || ti->detection_time != tr.elapsed()) {
+      std::cout << prof.name << " (" << variant << "): probe records do not match" << std::endl;
+      ok = false;
+    }
+    // Without latency all the time is spent waiting for the timeouts.
+    if (prof.latency == 0.0 && prof.fragment == 0 && prof.baud == 0 && tr.elapsed() != std::chrono::milliseconds(timeouts * delay)) {
+      std::cout << prof.name << " (" << variant << "): took " << tr.elapsed().count() << "us" << std::endl;
+      ok = false;
+    }
+
+    return ok;
+  }
+
+
+  // Count of the latency histogram bucket with the given upper bound.
+  unsigned long bucket(std::string_view le)
+  {
+    auto text = terminal::info::metrics();
+    auto key = std::format("termdetect_detection_seconds_bucket{{le=\"{}\"}} ", le);
+    auto pos = text.find(key);
+    return pos == std::string::npos ? 0 : std::stoul(text.substr(pos + key.size()));
+  }
+
+
+  // One record of a transcript, without delay.
+  std::string transcript_record(char type, std::string_view payload)
+  {
+    return std::string(1, type) + '\0' + char(payload.size()) + std::string(payload);
+  }
+
+} // anonymous namespace
+
+
+int main(int argc, char* argv[])
+{
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " PROFILE-DIR\n";
+    return EXIT_FAILURE;
+  }
+  std::filesystem::path dir = argv[1];
+
+  terminal::info::set_request_delay(delay);
+
+  int result = EXIT_SUCCESS;
+
+  for (const auto& e : expected_timeouts) {
+    auto prof = terminal::sim::profile::load((dir / (std::string(e.profile) + ".profile")).c_str());
+    if (! prof) {
+      std::cout << "cannot load profile " << e.profile << std::endl;
+      result = EXIT_FAILURE;
+      continue;
+    }
+
+    if (! check(*prof, e.timeouts, "plain"))
+      result = EXIT_FAILURE;
+
+    // Replies which arrive in pieces but before the timeout do not change anything.
+    prof->fragment = 2;
+    prof->fragment_delay = 10.0;
+    prof->latency = 100.0;
+    if (! check(*prof, e.timeouts, "slow"))
+      result = EXIT_FAILURE;
+  }
+
+  // A VT102 on a serial line answers DA1 like ST and does not answer DA2.  It must not be taken for ST.
+  terminal::sim::profile vt102;
+  vt102.name = "vt102";
+  vt102.term = "vt102";
+  vt102.expect = "unknown";
+  vt102.baud = 9600;
+  vt102.replies["\e[c"] = "\e[?6c";
+  vt102.replies["\eZ"] = "\e[?6c";
+  if (! check(vt102, 1, "serial"))
+    result = EXIT_FAILURE;
+
+  // The histogram buckets are upper bounds.  ST takes one timeout plus the latency, just over a bucket
+  // boundary.
+  if (auto st = terminal::sim::profile::load((dir / "st.profile").c_str()); st) {
+    st->latency = 0.6;
+    auto before = bucket("0.5");
+    auto before_next = bucket("1");
+    if (! check(*st, 1, "bucket") || bucket("0.5") != before || bucket("1") != before_next + 1) {
+      std::cout << "detection time counted in the wrong latency bucket" << std::endl;
+      result = EXIT_FAILURE;
+    }
+  }
+
+  // A request missing in a transcript is not answered with what is left of the replies before it.  The
+  // replies to later requests are still found.
+  {
+    auto fname = std::filesystem::temp_directory_path() / std::format("vtimetest-{}.trans", ::getpid());
+    std::ofstream(fname) << "TDTRANS\1" << transcript_record('E', "TERM=xterm") << transcript_record('R', "\e[>1;2;0c")
+                         << transcript_record('W', "\e[c") << transcript_record('R', "\e[?64;1;2c");
+    auto ti = terminal::info::replay(fname.c_str());
+    std::filesystem::remove(fname);
+    if (! ti || ! ti->raw.contains("DA1=64;1;2, DA2=<NO REPLY>")) {
+      std::cout << "replay with a missing request: got " << (ti ? ti->raw : "nothing") << std::endl;
+      result = EXIT_FAILURE;
+    }
+  }
+
+  // Unknown emulators are logged once per fingerprint.
+  auto unknown_log = std::filesystem::temp_directory_path() / std::format("vtimetest-{}.log", ::getpid());
+  terminal::info::set_unknown_log(unknown_log.c_str());
+
+  // An emulator which does not answer at all.  Every request times out.
+  terminal::sim::profile silent;
+  silent.name = "silent";
+  silent.term = "xterm";
+  silent.expect = "unknown";
+  if (! check(silent, 8, "plain") || ! check(silent, 8, "again"))
+    result = EXIT_FAILURE;
+
+  // Replies which arrive after the timeout are taken as replies to later requests.  Nothing must be
+  // recognized from the mix.
+  auto xterm = terminal::sim::profile::load((dir / "xterm.profile").c_str());
+  if (xterm) {
+    xterm->latency = delay * 2;
+    xterm->expect = "unknown";
+    if (! check(*xterm, 3, "late"))
+      result = EXIT_FAILURE;
+  }
+
+  std::ifstream in(unknown_log);
+  unsigned nlines = 0;
+  for (std::string line; std::getline(in, line); )
+    ++nlines;
+  if (nlines != 2) {
+    std::cout << "unknown log has " << nlines << " lines, expected 2" << std::endl;
+    result = EXIT_FAILURE;
+  }
+  std::filesystem::remove(unknown_log);
+
+  return result;
+}